@@ -79,6 +79,7 @@ build_envoy_asan:
 .PHONY: wasm_include
 wasm_include:
 	cp -f $$(bazel info bazel-bin)/extensions/common/node_info_generated.h $(TOP)/extensions/common/
+	cp -f $$(bazel info bazel-bin)/extensions/common/request_info_generated.h $(TOP)/extensions/common/
 	cp -fLR $$(bazel info bazel-bin)/external/com_github_google_flatbuffers/_virtual_includes/runtime_cc/flatbuffers $(TOP)/extensions/common/
 	cp -f $$(bazel info output_base)/external/envoy/api/wasm/cpp/contrib/proxy_expr.h $(TOP)/extensions/common/
 
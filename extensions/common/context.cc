@@ -16,9 +16,12 @@
 #include "extensions/common/context.h"
 
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "extensions/common/util.h"
+#include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/util/json_util.h"
+#include "google/protobuf/wire_format_lite.h"
 
 // WASM_PROLOG
 #ifndef NULL_PLUGIN
@@ -35,6 +38,7 @@ using Envoy::Extensions::Common::Wasm::Null::Plugin::getCurrentTimeNanoseconds;
 using Envoy::Extensions::Common::Wasm::Null::Plugin::getHeaderMapValue;
 using Envoy::Extensions::Common::Wasm::Null::Plugin::getMessageValue;
 using Envoy::Extensions::Common::Wasm::Null::Plugin::getValue;
+using Envoy::Extensions::Common::Wasm::Null::Plugin::setFilterState;
 
 #endif  // NULL_PLUGIN
 
@@ -52,38 +56,51 @@ const char kInboundPassthroughClusterIpv6[] = "InboundPassthroughClusterIpv6";
 
 namespace {
 
-// Extract service name from service host.
-void extractServiceName(const std::string& host,
-                        const std::string& destination_namespace,
-                        std::string* service_name) {
+// Extract service name from service host. The service name is a view into
+// the host.
+StringView extractServiceName(StringView host,
+                              StringView destination_namespace) {
   auto name_pos = host.find_first_of(".:");
-  if (name_pos == std::string::npos) {
+  if (name_pos == StringView::npos) {
     // host is already a short service name. return it directly.
-    *service_name = host;
-    return;
+    return host;
   }
   if (host[name_pos] == ':') {
     // host is `short_service:port`, return short_service name.
-    *service_name = host.substr(0, name_pos);
-    return;
+    return host.substr(0, name_pos);
   }
 
   auto namespace_pos = host.find_first_of(".:", name_pos + 1);
-  std::string service_namespace = "";
-  if (namespace_pos == std::string::npos) {
-    service_namespace = host.substr(name_pos + 1);
-  } else {
-    int namespace_size = namespace_pos - name_pos - 1;
-    service_namespace = host.substr(name_pos + 1, namespace_size);
-  }
+  auto service_namespace =
+      namespace_pos == StringView::npos
+          ? host.substr(name_pos + 1)
+          : host.substr(name_pos + 1, namespace_pos - name_pos - 1);
   // check if namespace in host is same as destination namespace.
   // If it is the same, return the first part of host as service name.
   // Otherwise fallback to request host.
   if (service_namespace == destination_namespace) {
-    *service_name = host.substr(0, name_pos);
-  } else {
-    *service_name = host;
+    return host.substr(0, name_pos);
   }
+  return host;
+}
+
+// Get the destination host of a cluster name following Istio convention (four
+// parts separated by pipe), as a view into the cluster name. Returns false if
+// the cluster name does not follow the convention.
+bool extractClusterHost(StringView cluster_name, StringView* host) {
+  size_t pos = 0;
+  for (int i = 0; i < 3; i++) {
+    pos = cluster_name.find('|', pos);
+    if (pos == StringView::npos) {
+      return false;
+    }
+    pos++;
+  }
+  if (cluster_name.find('|', pos) != StringView::npos) {
+    return false;
+  }
+  *host = cluster_name.substr(pos);
+  return true;
 }
 
 // Get destination service host and name based on destination cluster name and
@@ -97,16 +114,12 @@ void extractServiceName(const std::string& host,
 //   the second part of destination host is destination namespace, use first
 //   part as destination service name. Otherwise, fallback to use destination
 //   host for destination service name.
+// The host header is only read if the cluster name does not name the host.
 void getDestinationService(const std::string& dest_namespace,
                            bool use_host_header, std::string* dest_svc_host,
                            std::string* dest_svc_name) {
   std::string cluster_name;
   getValue({"cluster_name"}, &cluster_name);
-  *dest_svc_host = use_host_header
-                       ? getHeaderMapValue(HeaderMapType::RequestHeaders,
-                                           kAuthorityHeaderKey)
-                             ->toString()
-                       : "unknown";
 
   // override the cluster name if this is being sent to the
   // blackhole or passthrough cluster
@@ -118,59 +131,58 @@ void getDestinationService(const std::string& dest_namespace,
     cluster_name = kPassThroughCluster;
   }
 
-  if (cluster_name == kBlackHoleCluster ||
-      cluster_name == kPassThroughCluster ||
-      cluster_name == kInboundPassthroughClusterIpv4 ||
-      cluster_name == kInboundPassthroughClusterIpv6) {
-    *dest_svc_name = cluster_name;
+  const bool passthrough = cluster_name == kBlackHoleCluster ||
+                           cluster_name == kPassThroughCluster ||
+                           cluster_name == kInboundPassthroughClusterIpv4 ||
+                           cluster_name == kInboundPassthroughClusterIpv6;
+  StringView host;
+  if (!passthrough && extractClusterHost(cluster_name, &host)) {
+    dest_svc_host->assign(host.data(), host.size());
+  } else if (use_host_header) {
+    *dest_svc_host =
+        getHeaderMapValue(HeaderMapType::RequestHeaders, kAuthorityHeaderKey)
+            ->toString();
+  } else {
+    dest_svc_host->assign("unknown");
+  }
+  if (passthrough) {
+    dest_svc_name->swap(cluster_name);
     return;
   }
 
-  std::vector<absl::string_view> parts = absl::StrSplit(cluster_name, '|');
-  if (parts.size() == 4) {
-    *dest_svc_host = std::string(parts[3].data(), parts[3].size());
-  }
+  const auto name = extractServiceName(*dest_svc_host, dest_namespace);
+  dest_svc_name->assign(name.data(), name.size());
+}
 
-  extractServiceName(*dest_svc_host, dest_namespace, dest_svc_name);
+// Conversions of RequestInfo fields to and from FlatRequestInfo fields.
+flatbuffers::Offset<flatbuffers::String> toFlat(
+    flatbuffers::FlatBufferBuilder& fbb, bool stored,
+    const std::string& value) {
+  return stored ? fbb.CreateString(value)
+                : flatbuffers::Offset<flatbuffers::String>();
 }
 
-void populateRequestInfo(bool outbound, bool use_host_header_fallback,
-                         RequestInfo* request_info,
-                         const std::string& destination_namespace) {
-  request_info->is_populated = true;
-  // Fill in request info.
-  // Get destination service name and host based on cluster name and host
-  // header.
-  getDestinationService(destination_namespace, use_host_header_fallback,
-                        &request_info->destination_service_host,
-                        &request_info->destination_service_name);
+int64_t toFlat(flatbuffers::FlatBufferBuilder&, bool,
+               ServiceAuthenticationPolicy value) {
+  return static_cast<int64_t>(value);
+}
 
-  getValue({"request", "url_path"}, &request_info->request_url_path);
+template <typename T>
+T toFlat(flatbuffers::FlatBufferBuilder&, bool, T value) {
+  return value;
+}
 
-  if (outbound) {
-    uint64_t destination_port = 0;
-    getValue({"upstream", "port"}, &destination_port);
-    request_info->destination_port = destination_port;
-    getValue({"upstream", "uri_san_peer_certificate"},
-             &request_info->destination_principal);
-    getValue({"upstream", "uri_san_local_certificate"},
-             &request_info->source_principal);
+void fromFlat(const flatbuffers::String* value, std::string* out) {
+  if (value != nullptr) {
+    out->assign(value->c_str(), value->size());
   } else {
-    bool mtls = false;
-    if (getValue({"connection", "mtls"}, &mtls)) {
-      request_info->service_auth_policy =
-          mtls ? ::Wasm::Common::ServiceAuthenticationPolicy::MutualTLS
-               : ::Wasm::Common::ServiceAuthenticationPolicy::None;
-    }
-    getValue({"connection", "uri_san_local_certificate"},
-             &request_info->destination_principal);
-    getValue({"connection", "uri_san_peer_certificate"},
-             &request_info->source_principal);
+    out->clear();
   }
+}
 
-  uint64_t response_flags = 0;
-  getValue({"response", "flags"}, &response_flags);
-  request_info->response_flag = parseResponseFlag(response_flags);
+template <typename T, typename U>
+void fromFlat(U value, T* out) {
+  *out = static_cast<T>(value);
 }
 
 }  // namespace
@@ -197,44 +209,273 @@ TrafficDirection getTrafficDirection() {
   return TrafficDirection::Unspecified;
 }
 
-bool extractNodeFlatBuffer(const google::protobuf::Struct& metadata,
-                           flatbuffers::FlatBufferBuilder& fbb) {
-  flatbuffers::Offset<flatbuffers::String> name, namespace_, owner,
-      workload_name, istio_version, mesh_id;
-  std::vector<flatbuffers::Offset<KeyVal>> labels, platform_metadata;
-  std::vector<flatbuffers::Offset<flatbuffers::String>> app_containers;
-  for (const auto& it : metadata.fields()) {
-    if (it.first == "NAME") {
-      name = fbb.CreateString(it.second.string_value());
-    } else if (it.first == "NAMESPACE") {
-      namespace_ = fbb.CreateString(it.second.string_value());
-    } else if (it.first == "OWNER") {
-      owner = fbb.CreateString(it.second.string_value());
-    } else if (it.first == "WORKLOAD_NAME") {
-      workload_name = fbb.CreateString(it.second.string_value());
-    } else if (it.first == "ISTIO_VERSION") {
-      istio_version = fbb.CreateString(it.second.string_value());
-    } else if (it.first == "MESH_ID") {
-      mesh_id = fbb.CreateString(it.second.string_value());
-    } else if (it.first == "LABELS") {
-      for (const auto& labels_it : it.second.struct_value().fields()) {
-        labels.push_back(
-            CreateKeyVal(fbb, fbb.CreateString(labels_it.first),
-                         fbb.CreateString(labels_it.second.string_value())));
-      }
-    } else if (it.first == "PLATFORM_METADATA") {
-      for (const auto& platform_it : it.second.struct_value().fields()) {
-        platform_metadata.push_back(
-            CreateKeyVal(fbb, fbb.CreateString(platform_it.first),
-                         fbb.CreateString(platform_it.second.string_value())));
-      }
-    } else if (it.first == "APP_CONTAINERS") {
-      for (const auto& containers_it : it.second.list_value().values()) {
-        app_containers.push_back(
-            fbb.CreateString(containers_it.string_value()));
-      }
+namespace {
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
+
+// Node metadata fields copied into a FlatNode, as views into the metadata.
+struct NodeFields {
+  StringView name;
+  StringView namespace_;
+  StringView owner;
+  StringView workload_name;
+  StringView istio_version;
+  StringView mesh_id;
+  std::vector<std::pair<StringView, StringView>> labels;
+  std::vector<std::pair<StringView, StringView>> platform_metadata;
+  std::vector<StringView> app_containers;
+};
+
+// google.protobuf.Value read from its wire format. Only string values, and
+// structs and lists of string values, are kept.
+struct ValueFields {
+  StringView string_value;
+  std::vector<std::pair<StringView, StringView>> struct_value;
+  std::vector<StringView> list_value;
+};
+
+// Tags of the google.protobuf.Struct, Value and ListValue fields read.
+constexpr uint32_t kStructFieldsTag = WireFormatLite::MakeTag(
+    1, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t kFieldsEntryKeyTag = WireFormatLite::MakeTag(
+    1, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t kFieldsEntryValueTag = WireFormatLite::MakeTag(
+    2, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t kValueStringTag = WireFormatLite::MakeTag(
+    3, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t kValueStructTag = WireFormatLite::MakeTag(
+    5, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t kValueListTag = WireFormatLite::MakeTag(
+    6, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t kListValuesTag = WireFormatLite::MakeTag(
+    1, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+// Reads a length delimited field as a view into the input buffer.
+bool readView(CodedInputStream& input, StringView* out) {
+  uint32_t size;
+  if (!input.ReadVarint32(&size)) {
+    return false;
+  }
+  if (size == 0) {
+    *out = StringView();
+    return true;
+  }
+  const void* data;
+  int available;
+  if (!input.GetDirectBufferPointer(&data, &available) ||
+      static_cast<uint32_t>(available) < size) {
+    return false;
+  }
+  *out = StringView(static_cast<const char*>(data), size);
+  return input.Skip(size);
+}
+
+// Reads a length delimited field as a view into the input buffer, or as a
+// copy into the scratch string when it spans buffers of the input.
+bool readBytes(CodedInputStream& input, std::string* scratch,
+               StringView* out) {
+  uint32_t size;
+  if (!input.ReadVarint32(&size)) {
+    return false;
+  }
+  if (size == 0) {
+    *out = StringView();
+    return true;
+  }
+  const void* data;
+  int available;
+  if (input.GetDirectBufferPointer(&data, &available) &&
+      static_cast<uint32_t>(available) >= size) {
+    *out = StringView(static_cast<const char*>(data), size);
+    return input.Skip(size);
+  }
+  if (!input.ReadString(scratch, size)) {
+    return false;
+  }
+  *out = *scratch;
+  return true;
+}
+
+// Reads the fields of an embedded message with read_field, which is called
+// with the tag of each field. Unknown fields are skipped by read_field.
+template <typename ReadField>
+bool readMessage(CodedInputStream& input, ReadField read_field) {
+  // Limits are clamped to the enclosing limit, so a truncated message would
+  // otherwise read as complete.
+  uint32_t size;
+  if (!input.ReadVarint32(&size) ||
+      size > static_cast<uint32_t>(input.BytesUntilLimit())) {
+    return false;
+  }
+  const auto limit = input.PushLimit(size);
+  while (const uint32_t tag = input.ReadTag()) {
+    if (!read_field(tag)) {
+      return false;
+    }
+  }
+  if (input.BytesUntilLimit() != 0) {
+    return false;
+  }
+  input.PopLimit(limit);
+  return true;
+}
+
+// Reads a Struct field entry, with read_value reading its value.
+template <typename ReadValue>
+bool readFieldsEntry(CodedInputStream& input, StringView* key,
+                     ReadValue read_value) {
+  *key = StringView();
+  return readMessage(input, [&](uint32_t tag) {
+    if (tag == kFieldsEntryKeyTag) {
+      return readView(input, key);
+    }
+    if (tag == kFieldsEntryValueTag) {
+      return read_value();
+    }
+    return WireFormatLite::SkipField(&input, tag);
+  });
+}
+
+// Reads a Value, keeping its string value. Values of other kinds read as an
+// empty string, as with Value::string_value().
+bool readStringValue(CodedInputStream& input, StringView* out) {
+  *out = StringView();
+  return readMessage(input, [&](uint32_t tag) {
+    if (tag == kValueStringTag) {
+      return readView(input, out);
+    }
+    *out = StringView();
+    return WireFormatLite::SkipField(&input, tag);
+  });
+}
+
+// Reads a Struct of string values. Later entries replace earlier ones with
+// the same key, as when parsing the Struct map.
+bool readStringStruct(CodedInputStream& input,
+                      std::vector<std::pair<StringView, StringView>>* out) {
+  out->clear();
+  const bool ok = readMessage(input, [&](uint32_t tag) {
+    if (tag != kStructFieldsTag) {
+      return WireFormatLite::SkipField(&input, tag);
+    }
+    StringView key, value;
+    if (!readFieldsEntry(input, &key, [&]() {
+          return readStringValue(input, &value);
+        })) {
+      return false;
+    }
+    out->emplace_back(key, value);
+    return true;
+  });
+  if (!ok) {
+    return false;
+  }
+  std::stable_sort(out->begin(), out->end(),
+                   [](const std::pair<StringView, StringView>& a,
+                      const std::pair<StringView, StringView>& b) {
+                     return a.first < b.first;
+                   });
+  auto last = out->begin();
+  for (auto it = out->begin(); it != out->end(); ++it) {
+    if (it + 1 == out->end() || (it + 1)->first != it->first) {
+      *last++ = *it;
     }
   }
+  out->erase(last, out->end());
+  return true;
+}
+
+// Reads a ListValue of string values.
+bool readStringList(CodedInputStream& input, std::vector<StringView>* out) {
+  out->clear();
+  return readMessage(input, [&](uint32_t tag) {
+    if (tag != kListValuesTag) {
+      return WireFormatLite::SkipField(&input, tag);
+    }
+    StringView value;
+    if (!readStringValue(input, &value)) {
+      return false;
+    }
+    out->push_back(value);
+    return true;
+  });
+}
+
+// Reads a top level Value of the node metadata.
+bool readValue(CodedInputStream& input, ValueFields* out) {
+  *out = ValueFields();
+  return readMessage(input, [&](uint32_t tag) {
+    // Setting a field of the kind oneof clears the others.
+    *out = ValueFields();
+    if (tag == kValueStringTag) {
+      return readView(input, &out->string_value);
+    }
+    if (tag == kValueStructTag) {
+      return readStringStruct(input, &out->struct_value);
+    }
+    if (tag == kValueListTag) {
+      return readStringList(input, &out->list_value);
+    }
+    return WireFormatLite::SkipField(&input, tag);
+  });
+}
+
+// Sets the node field for a top level metadata key.
+void setNodeField(StringView key, ValueFields&& value, NodeFields* node) {
+  if (key == "NAME") {
+    node->name = value.string_value;
+  } else if (key == "NAMESPACE") {
+    node->namespace_ = value.string_value;
+  } else if (key == "OWNER") {
+    node->owner = value.string_value;
+  } else if (key == "WORKLOAD_NAME") {
+    node->workload_name = value.string_value;
+  } else if (key == "ISTIO_VERSION") {
+    node->istio_version = value.string_value;
+  } else if (key == "MESH_ID") {
+    node->mesh_id = value.string_value;
+  } else if (key == "LABELS") {
+    node->labels = std::move(value.struct_value);
+  } else if (key == "PLATFORM_METADATA") {
+    node->platform_metadata = std::move(value.struct_value);
+  } else if (key == "APP_CONTAINERS") {
+    node->app_containers = std::move(value.list_value);
+  }
+}
+
+flatbuffers::Offset<flatbuffers::String> createString(
+    flatbuffers::FlatBufferBuilder& fbb, StringView value) {
+  return fbb.CreateString(value.data(), value.size());
+}
+
+std::vector<flatbuffers::Offset<KeyVal>> createKeyVals(
+    flatbuffers::FlatBufferBuilder& fbb,
+    const std::vector<std::pair<StringView, StringView>>& values) {
+  std::vector<flatbuffers::Offset<KeyVal>> key_vals;
+  key_vals.reserve(values.size());
+  for (const auto& it : values) {
+    key_vals.push_back(CreateKeyVal(fbb, createString(fbb, it.first),
+                                    createString(fbb, it.second)));
+  }
+  return key_vals;
+}
+
+void buildNodeFlatBuffer(const NodeFields& fields,
+                         flatbuffers::FlatBufferBuilder& fbb) {
+  auto name = createString(fbb, fields.name);
+  auto namespace_ = createString(fbb, fields.namespace_);
+  auto owner = createString(fbb, fields.owner);
+  auto workload_name = createString(fbb, fields.workload_name);
+  auto istio_version = createString(fbb, fields.istio_version);
+  auto mesh_id = createString(fbb, fields.mesh_id);
+  auto labels = createKeyVals(fbb, fields.labels);
+  auto platform_metadata = createKeyVals(fbb, fields.platform_metadata);
+  std::vector<flatbuffers::Offset<flatbuffers::String>> app_containers;
+  app_containers.reserve(fields.app_containers.size());
+  for (const auto& container : fields.app_containers) {
+    app_containers.push_back(createString(fbb, container));
+  }
   // finish pre-order construction
   auto labels_offset = fbb.CreateVectorOfSortedTables(&labels);
   auto platform_metadata_offset =
@@ -252,9 +493,104 @@ bool extractNodeFlatBuffer(const google::protobuf::Struct& metadata,
   node.add_app_containers(app_containers_offset);
   auto data = node.Finish();
   fbb.Finish(data);
+}
+
+}  // namespace
+
+bool extractNodeFlatBuffer(const google::protobuf::Struct& metadata,
+                           flatbuffers::FlatBufferBuilder& fbb) {
+  NodeFields node;
+  for (const auto& it : metadata.fields()) {
+    ValueFields value;
+    value.string_value = it.second.string_value();
+    for (const auto& struct_it : it.second.struct_value().fields()) {
+      value.struct_value.emplace_back(struct_it.first,
+                                      struct_it.second.string_value());
+    }
+    for (const auto& list_it : it.second.list_value().values()) {
+      value.list_value.push_back(list_it.string_value());
+    }
+    setNodeField(it.first, std::move(value), &node);
+  }
+  buildNodeFlatBuffer(node, fbb);
   return true;
 }
 
+bool extractNodeFlatBufferFromBytes(StringView metadata,
+                                    flatbuffers::FlatBufferBuilder& fbb) {
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(metadata.data()),
+                         metadata.size());
+  NodeFields node;
+  while (const uint32_t tag = input.ReadTag()) {
+    if (tag != kStructFieldsTag) {
+      if (!WireFormatLite::SkipField(&input, tag)) {
+        return false;
+      }
+      continue;
+    }
+    StringView key;
+    ValueFields value;
+    if (!readFieldsEntry(input, &key,
+                         [&]() { return readValue(input, &value); })) {
+      return false;
+    }
+    setNodeField(key, std::move(value), &node);
+  }
+  if (!input.ConsumedEntireMessage()) {
+    return false;
+  }
+  buildNodeFlatBuffer(node, fbb);
+  return true;
+}
+
+bool readStructEntries(
+    CodedInputStream& input,
+    const std::function<bool(StringView key, StringView value,
+                             std::string* value_copy)>& read_entry) {
+  std::string key_scratch, value_scratch;
+  return readMessage(input, [&](uint32_t tag) {
+    if (tag != kStructFieldsTag) {
+      return WireFormatLite::SkipField(&input, tag);
+    }
+    StringView key, value;
+    bool copied = false;
+    const bool ok = readMessage(input, [&](uint32_t entry_tag) {
+      if (entry_tag == kFieldsEntryKeyTag) {
+        return readBytes(input, &key_scratch, &key);
+      }
+      if (entry_tag == kFieldsEntryValueTag) {
+        if (!readBytes(input, &value_scratch, &value)) {
+          return false;
+        }
+        copied = !value.empty() && value.data() == value_scratch.data();
+        return true;
+      }
+      return WireFormatLite::SkipField(&input, entry_tag);
+    });
+    return ok && read_entry(key, value, copied ? &value_scratch : nullptr);
+  });
+}
+
+bool readValueKind(StringView value, ValueKind kind, StringView* out) {
+  const uint32_t kind_tag =
+      kind == ValueKind::String ? kValueStringTag : kValueStructTag;
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(value.data()),
+                         value.size());
+  bool found = false;
+  while (const uint32_t tag = input.ReadTag()) {
+    // Setting a field of the kind oneof clears the others.
+    found = tag == kind_tag;
+    if (found) {
+      if (!readView(input, out)) {
+        return false;
+      }
+    } else if (!WireFormatLite::SkipField(&input, tag)) {
+      return false;
+    }
+  }
+  return found && input.ConsumedEntireMessage();
+}
+
 bool extractLocalNodeFlatBuffer(std::string* out) {
   google::protobuf::Struct node;
   if (!getMessageValue({"node", "metadata"}, &node)) {
@@ -278,76 +614,327 @@ void extractEmptyNodeFlatBuffer(std::string* out) {
               fbb.GetSize());
 }
 
-// Host header is used if use_host_header_fallback==true.
-// Normally it is ok to use host header within the mesh, but not at ingress.
-void populateHTTPRequestInfo(bool outbound, bool use_host_header_fallback,
-                             RequestInfo* request_info,
-                             const std::string& destination_namespace) {
-  populateRequestInfo(outbound, use_host_header_fallback, request_info,
-                      destination_namespace);
-
-  int64_t response_code = 0;
-  if (getValue({"response", "code"}, &response_code)) {
-    request_info->response_code = response_code;
+std::string RequestInfo::accessedFields() const {
+  std::vector<StringView> names;
+#define REQUEST_INFO_FIELD_NAME(type, name, default_value) \
+  if (accessed_ & bit(Field::name)) {                      \
+    names.push_back(#name);                                \
   }
+  REQUEST_INFO_FIELDS(REQUEST_INFO_FIELD_NAME)
+#undef REQUEST_INFO_FIELD_NAME
+  return absl::StrJoin(names, ",");
+}
 
-  int64_t grpc_status_code = 2;
-  getValue({"response", "grpc_status"}, &grpc_status_code);
-  request_info->grpc_status = grpc_status_code;
+void RequestInfo::bind(Source source, bool outbound,
+                       bool use_host_header_fallback,
+                       const std::string& destination_namespace) {
+#define REQUEST_INFO_FIELD_RESET(type, name, default_value) \
+  if ((set_ & bit(Field::name)) == 0) {                     \
+    name##_ = type{default_value};                          \
+  }
+  REQUEST_INFO_FIELDS(REQUEST_INFO_FIELD_RESET)
+#undef REQUEST_INFO_FIELD_RESET
+  fetched_ = set_;
+  shared_ = 0;
+  source_ = source;
+  outbound_ = outbound;
+  use_host_header_fallback_ = use_host_header_fallback;
+  destination_namespace_ = destination_namespace;
+  is_populated = true;
+}
 
-  if (kGrpcContentTypes.count(getHeaderMapValue(HeaderMapType::RequestHeaders,
-                                                kContentTypeHeaderKey)
-                                  ->toString()) != 0) {
-    request_info->request_protocol = kProtocolGRPC;
-  } else {
-    // TODO Add http/1.1, http/1.0, http/2 in a separate attribute.
-    // http|grpc classification is compatible with Mixerclient
-    request_info->request_protocol = kProtocolHTTP;
+void RequestInfo::fetch(Field field) const {
+  fetched_ |= bit(field);
+  if (source_ == Source::None) {
+    return;
   }
+  const bool http = source_ == Source::HTTP;
+  // Fields read together are only assigned if not set explicitly.
+  auto fetch_along = [this](Field other) {
+    if ((fetched_ & bit(other)) != 0) {
+      return false;
+    }
+    fetched_ |= bit(other);
+    return true;
+  };
+
+  switch (field) {
+    case Field::start_time:
+      if (http) {
+        getValue({"request", "time"}, &start_time_);
+      }
+      break;
+    case Field::duration:
+      if (http) {
+        getValue({"request", "duration"}, &duration_);
+      }
+      break;
+    case Field::request_size:
+      if (http) {
+        getValue({"request", "total_size"}, &request_size_);
+      }
+      break;
+    case Field::response_size:
+      if (http) {
+        getValue({"response", "total_size"}, &response_size_);
+      }
+      break;
+    case Field::destination_port: {
+      uint64_t destination_port = 0;
+      if (outbound_) {
+        getValue({"upstream", "port"}, &destination_port);
+      } else if (http) {
+        getValue({"destination", "port"}, &destination_port);
+      }
+      destination_port_ = destination_port;
+      break;
+    }
+    case Field::request_protocol:
+      if (!http) {
+        request_protocol_ = kProtocolTCP;
+      } else if (kGrpcContentTypes.count(
+                     getHeaderMapValue(HeaderMapType::RequestHeaders,
+                                       kContentTypeHeaderKey)
+                         ->toString()) != 0) {
+        request_protocol_ = kProtocolGRPC;
+      } else {
+        // TODO Add http/1.1, http/1.0, http/2 in a separate attribute.
+        // http|grpc classification is compatible with Mixerclient
+        request_protocol_ = kProtocolHTTP;
+      }
+      break;
+    case Field::response_code: {
+      int64_t response_code = 0;
+      if (http && getValue({"response", "code"}, &response_code)) {
+        response_code_ = response_code;
+      }
+      break;
+    }
+    case Field::grpc_status: {
+      int64_t grpc_status_code = 2;
+      if (http) {
+        getValue({"response", "grpc_status"}, &grpc_status_code);
+      }
+      grpc_status_ = grpc_status_code;
+      break;
+    }
+    case Field::response_flag: {
+      uint64_t response_flags = 0;
+      getValue({"response", "flags"}, &response_flags);
+      const auto response_flag = parseResponseFlag(response_flags);
+      response_flag_.assign(response_flag.data(), response_flag.size());
+      break;
+    }
+    case Field::destination_service_host:
+    case Field::destination_service_name: {
+      // Get destination service name and host based on cluster name and host
+      // header.
+      // Host header is used if use_host_header_fallback==true.
+      // Normally it is ok to use host header within the mesh, but not at
+      // ingress.
+      std::string host, name;
+      getDestinationService(destination_namespace_,
+                            http && use_host_header_fallback_, &host, &name);
+      if (field == Field::destination_service_host ||
+          fetch_along(Field::destination_service_host)) {
+        destination_service_host_ = std::move(host);
+      }
+      if (field == Field::destination_service_name ||
+          fetch_along(Field::destination_service_name)) {
+        destination_service_name_ = std::move(name);
+      }
+      break;
+    }
+    case Field::request_operation:
+      if (http) {
+        request_operation_ =
+            getHeaderMapValue(HeaderMapType::RequestHeaders, kMethodHeaderKey)
+                ->toString();
+      }
+      break;
+    case Field::request_url_path:
+      getValue({"request", "url_path"}, &request_url_path_);
+      break;
+    case Field::service_auth_policy: {
+      bool mtls = false;
+      if (!outbound_ && getValue({"connection", "mtls"}, &mtls)) {
+        service_auth_policy_ =
+            mtls ? ::Wasm::Common::ServiceAuthenticationPolicy::MutualTLS
+                 : ::Wasm::Common::ServiceAuthenticationPolicy::None;
+      }
+      break;
+    }
+    case Field::source_principal:
+      if (outbound_) {
+        getValue({"upstream", "uri_san_local_certificate"},
+                 &source_principal_);
+      } else {
+        getValue({"connection", "uri_san_peer_certificate"},
+                 &source_principal_);
+      }
+      break;
+    case Field::destination_principal:
+      if (outbound_) {
+        getValue({"upstream", "uri_san_peer_certificate"},
+                 &destination_principal_);
+      } else {
+        getValue({"connection", "uri_san_local_certificate"},
+                 &destination_principal_);
+      }
+      break;
+    case Field::source_address:
+      if (http) {
+        getValue({"source", "address"}, &source_address_);
+      }
+      break;
+    case Field::destination_address:
+      if (http) {
+        getValue({"destination", "address"}, &destination_address_);
+      }
+      break;
+    case Field::referer:
+      if (http) {
+        getValue({"request", "referer"}, &referer_);
+      }
+      break;
+    case Field::user_agent:
+      if (http) {
+        getValue({"request", "user_agent"}, &user_agent_);
+      }
+      break;
+    case Field::request_id:
+      if (http) {
+        getValue({"request", "id"}, &request_id_);
+      }
+      break;
+    case Field::b3_trace_id:
+    case Field::b3_span_id:
+    case Field::b3_trace_sampled: {
+      std::string trace_sampled;
+      if (!http ||
+          !getValue({"request", "headers", "x-b3-sampled"}, &trace_sampled) ||
+          trace_sampled != "1") {
+        fetched_ |= bit(Field::b3_trace_id) | bit(Field::b3_span_id) |
+                     bit(Field::b3_trace_sampled);
+        break;
+      }
+      if (field == Field::b3_trace_id || fetch_along(Field::b3_trace_id)) {
+        getValue({"request", "headers", "x-b3-traceid"}, &b3_trace_id_);
+      }
+      if (field == Field::b3_span_id || fetch_along(Field::b3_span_id)) {
+        getValue({"request", "headers", "x-b3-spanid"}, &b3_span_id_);
+      }
+      if (field == Field::b3_trace_sampled ||
+          fetch_along(Field::b3_trace_sampled)) {
+        b3_trace_sampled_ = true;
+      }
+      break;
+    }
+    case Field::url_path:
+      if (http) {
+        getValue({"request", "url_path"}, &url_path_);
+      }
+      break;
+    case Field::url_host:
+      if (http) {
+        getValue({"request", "host"}, &url_host_);
+      }
+      break;
+    case Field::url_scheme:
+      if (http) {
+        getValue({"request", "scheme"}, &url_scheme_);
+      }
+      break;
+  }
+}
 
-  request_info->request_operation =
-      getHeaderMapValue(HeaderMapType::RequestHeaders, kMethodHeaderKey)
-          ->toString();
+void RequestInfo::serialize(std::string* out) const {
+  flatbuffers::FlatBufferBuilder fbb;
+  const auto destination_namespace = fbb.CreateString(destination_namespace_);
+#define REQUEST_INFO_FIELD_TO_FLAT(type, name, default_value) \
+  const auto name##_flat = toFlat(fbb, fetched_ & bit(Field::name), name##_);
+  REQUEST_INFO_FIELDS(REQUEST_INFO_FIELD_TO_FLAT)
+#undef REQUEST_INFO_FIELD_TO_FLAT
+
+  FlatRequestInfoBuilder request_info(fbb);
+  request_info.add_fields(fetched_);
+  request_info.add_outbound(outbound_);
+  request_info.add_use_host_header_fallback(use_host_header_fallback_);
+  request_info.add_destination_namespace(destination_namespace);
+#define REQUEST_INFO_FIELD_ADD(type, name, default_value) \
+  if (fetched_ & bit(Field::name)) {                      \
+    request_info.add_##name(name##_flat);                 \
+  }
+  REQUEST_INFO_FIELDS(REQUEST_INFO_FIELD_ADD)
+#undef REQUEST_INFO_FIELD_ADD
+  fbb.Finish(request_info.Finish());
+  out->assign(reinterpret_cast<const char*>(fbb.GetBufferPointer()),
+              fbb.GetSize());
+}
 
-  if (!outbound) {
-    uint64_t destination_port = 0;
-    getValue({"destination", "port"}, &destination_port);
-    request_info->destination_port = destination_port;
+void RequestInfo::load(const FlatRequestInfo& shared) {
+  const uint64_t direction_fields =
+      bit(Field::destination_port) | bit(Field::service_auth_policy) |
+      bit(Field::source_principal) | bit(Field::destination_principal);
+  const uint64_t service_fields = bit(Field::destination_service_host) |
+                                  bit(Field::destination_service_name);
+
+  shared_ = shared.fields();
+  uint64_t fields = shared_ & ~fetched_;
+  if (shared.outbound() != outbound_) {
+    fields &= ~(direction_fields | service_fields);
+  }
+  const auto destination_namespace = shared.destination_namespace();
+  if (shared.use_host_header_fallback() != use_host_header_fallback_ ||
+      destination_namespace == nullptr ||
+      StringView(destination_namespace->c_str(),
+                 destination_namespace->size()) != destination_namespace_) {
+    fields &= ~service_fields;
   }
 
-  getValue({"request", "time"}, &request_info->start_time);
-  getValue({"request", "duration"}, &request_info->duration);
-  getValue({"request", "total_size"}, &request_info->request_size);
-  getValue({"response", "total_size"}, &request_info->response_size);
+#define REQUEST_INFO_FIELD_FROM_FLAT(type, name, default_value) \
+  if (fields & bit(Field::name)) {                              \
+    fromFlat(shared.name(), &name##_);                          \
+  }
+  REQUEST_INFO_FIELDS(REQUEST_INFO_FIELD_FROM_FLAT)
+#undef REQUEST_INFO_FIELD_FROM_FLAT
+  fetched_ |= fields;
 }
 
-void populateExtendedHTTPRequestInfo(RequestInfo* request_info) {
-  getValue({"source", "address"}, &request_info->source_address);
-  getValue({"destination", "address"}, &request_info->destination_address);
+void populateHTTPRequestInfo(bool outbound, bool use_host_header_fallback,
+                             RequestInfo* request_info,
+                             const std::string& destination_namespace) {
+  request_info->bind(RequestInfo::Source::HTTP, outbound,
+                     use_host_header_fallback, destination_namespace);
+}
 
-  getValue({"request", "referer"}, &request_info->referer);
-  getValue({"request", "user_agent"}, &request_info->user_agent);
-  getValue({"request", "id"}, &request_info->request_id);
-  std::string trace_sampled;
-  if (getValue({"request", "headers", "x-b3-sampled"}, &trace_sampled) &&
-      trace_sampled == "1") {
-    getValue({"request", "headers", "x-b3-traceid"},
-             &request_info->b3_trace_id);
-    getValue({"request", "headers", "x-b3-spanid"}, &request_info->b3_span_id);
-    request_info->b3_trace_sampled = true;
+void loadSharedHTTPRequestInfo(RequestInfo* request_info) {
+  std::string shared;
+  if (!getValue({"filter_state", kRequestInfoKey}, &shared)) {
+    return;
+  }
+  flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t*>(shared.data()), shared.size());
+  if (VerifyFlatRequestInfoBuffer(verifier)) {
+    request_info->load(*GetFlatRequestInfo(shared.data()));
   }
+}
 
-  getValue({"request", "url_path"}, &request_info->url_path);
-  getValue({"request", "host"}, &request_info->url_host);
-  getValue({"request", "scheme"}, &request_info->url_scheme);
+void shareHTTPRequestInfo(const RequestInfo& request_info) {
+  if (request_info.source_ != RequestInfo::Source::HTTP ||
+      (request_info.fetched_ & ~request_info.shared_) == 0) {
+    return;
+  }
+  std::string shared;
+  request_info.serialize(&shared);
+  setFilterState(kRequestInfoKey, shared);
 }
 
 void populateTCPRequestInfo(bool outbound, RequestInfo* request_info,
                             const std::string& destination_namespace) {
   // host_header_fallback is for HTTP/gRPC only.
-  populateRequestInfo(outbound, false, request_info, destination_namespace);
-
-  request_info->request_protocol = kProtocolTCP;
+  request_info->bind(RequestInfo::Source::TCP, outbound, false,
+                     destination_namespace);
 }
 
 google::protobuf::util::Status extractNodeMetadataValue(
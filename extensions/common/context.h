@@ -15,11 +15,14 @@
 
 #pragma once
 
+#include <functional>
 #include <set>
 
 #include "absl/strings/string_view.h"
 #include "extensions/common/node_info_generated.h"
+#include "extensions/common/request_info_generated.h"
 #include "flatbuffers/flatbuffers.h"
+#include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/struct.pb.h"
 
 namespace Wasm {
@@ -45,6 +48,9 @@ const std::string kMetadataNotFoundValue =
 
 constexpr StringView kAccessLogPolicyKey = "envoy.wasm.access_log.log";
 
+// Filter state key of the RequestInfo shared between plugins.
+constexpr StringView kRequestInfoKey = "envoy.wasm.request_info";
+
 // Header keys
 constexpr StringView kAuthorityHeaderKey = ":authority";
 constexpr StringView kMethodHeaderKey = ":method";
@@ -68,75 +74,120 @@ constexpr StringView kNone = "NONE";
 
 StringView AuthenticationPolicyString(ServiceAuthenticationPolicy policy);
 
-// RequestInfo represents the information collected from filter stream
-// callbacks. This is used to fill metrics and logs.
-struct RequestInfo {
-  // Start timestamp in nanoseconds.
-  int64_t start_time;
-
-  // The total duration of the request in nanoseconds.
-  int64_t duration;
-
-  // Request total size in bytes, include header, body, and trailer.
-  int64_t request_size = 0;
-
-  // Response total size in bytes, include header, body, and trailer.
-  int64_t response_size = 0;
-
-  // Destination port that the request targets.
-  uint32_t destination_port = 0;
-
-  // Protocol used the request (HTTP/1.1, gRPC, etc).
-  std::string request_protocol;
-
-  // Response code of the request.
-  uint32_t response_code = 0;
-
-  // gRPC status code for the request.
-  uint32_t grpc_status = 2;
-
-  // Response flag giving additional information - NR, UAEX etc.
-  // TODO populate
-  std::string response_flag;
-
-  // Host name of destination service.
-  std::string destination_service_host;
-
-  // Short name of destination service.
-  std::string destination_service_name;
-
-  // Operation of the request, i.e. HTTP method or gRPC API method.
-  std::string request_operation;
-
-  // The path portion of the URL without the query string.
-  std::string request_url_path;
-
-  // Service authentication policy (NONE, MUTUAL_TLS)
-  ServiceAuthenticationPolicy service_auth_policy =
-      ServiceAuthenticationPolicy::Unspecified;
+// Fields of RequestInfo read from the stream attributes, as
+// (type, name, default value). The position of a field is its bit in the
+// shared RequestInfo, so new fields are only appended, and are also added to
+// request_info.fbs.
+#define REQUEST_INFO_FIELDS(FIELD)                                       \
+  /* Start timestamp in nanoseconds. */                                  \
+  FIELD(int64_t, start_time, 0)                                          \
+  /* The total duration of the request in nanoseconds. */                \
+  FIELD(int64_t, duration, 0)                                            \
+  /* Request total size in bytes, include header, body, and trailer. */  \
+  FIELD(int64_t, request_size, 0)                                        \
+  /* Response total size in bytes, include header, body, and trailer. */ \
+  FIELD(int64_t, response_size, 0)                                       \
+  /* Destination port that the request targets. */                       \
+  FIELD(uint32_t, destination_port, 0)                                   \
+  /* Protocol used the request (HTTP/1.1, gRPC, etc). */                 \
+  FIELD(std::string, request_protocol, )                                 \
+  /* Response code of the request. */                                    \
+  FIELD(uint32_t, response_code, 0)                                      \
+  /* gRPC status code for the request. */                                \
+  FIELD(uint32_t, grpc_status, 2)                                        \
+  /* Response flag giving additional information - NR, UAEX etc. */      \
+  FIELD(std::string, response_flag, )                                    \
+  /* Host name of destination service. */                                \
+  FIELD(std::string, destination_service_host, )                         \
+  /* Short name of destination service. */                               \
+  FIELD(std::string, destination_service_name, )                         \
+  /* Operation of the request, i.e. HTTP method or gRPC API method. */   \
+  FIELD(std::string, request_operation, )                                \
+  /* The path portion of the URL without the query string. */            \
+  FIELD(std::string, request_url_path, )                                 \
+  /* Service authentication policy (NONE, MUTUAL_TLS) */                 \
+  FIELD(ServiceAuthenticationPolicy, service_auth_policy,                \
+        ServiceAuthenticationPolicy::Unspecified)                        \
+  /* Principal of source and destination workload extracted from TLS */  \
+  /* certificate. */                                                     \
+  FIELD(std::string, source_principal, )                                 \
+  FIELD(std::string, destination_principal, )                            \
+  /* The following fields are only read for HTTP requests. */            \
+  FIELD(std::string, source_address, )                                   \
+  FIELD(std::string, destination_address, )                              \
+  /* Important Headers. */                                               \
+  FIELD(std::string, referer, )                                          \
+  FIELD(std::string, user_agent, )                                       \
+  FIELD(std::string, request_id, )                                       \
+  FIELD(std::string, b3_trace_id, )                                      \
+  FIELD(std::string, b3_span_id, )                                       \
+  FIELD(bool, b3_trace_sampled, false)                                   \
+  /* HTTP URL related attributes. */                                     \
+  FIELD(std::string, url_path, )                                         \
+  FIELD(std::string, url_host, )                                         \
+  FIELD(std::string, url_scheme, )
+
+class RequestInfo;
+
+// populateHTTPRequestInfo binds the RequestInfo to the current HTTP stream.
+// Fields are read from the stream attributes when first accessed, so it must
+// be called with the stream context in effect.
+void populateHTTPRequestInfo(bool outbound, bool use_host_header,
+                             RequestInfo* request_info,
+                             const std::string& destination_namespace);
 
-  // Principal of source and destination workload extracted from TLS
-  // certificate.
-  std::string source_principal;
-  std::string destination_principal;
+// loadSharedHTTPRequestInfo reuses the fields shared by another plugin of the
+// stream, if they were read with a compatible configuration. It must be called
+// after populateHTTPRequestInfo. Sharing costs a filter state read and write
+// per request, so plugins only share when configured to.
+void loadSharedHTTPRequestInfo(RequestInfo* request_info);
 
-  // The following fields will only be populated by calling
-  // populateExtendedHTTPRequestInfo.
-  std::string source_address;
-  std::string destination_address;
+// shareHTTPRequestInfo stores the fields read so far in the filter state for
+// the other plugins of the stream. It does nothing if no new field was read.
+void shareHTTPRequestInfo(const RequestInfo& request_info);
 
-  // Important Headers.
-  std::string referer;
-  std::string user_agent;
-  std::string request_id;
-  std::string b3_trace_id;
-  std::string b3_span_id;
-  bool b3_trace_sampled = false;
+// populateTCPRequestInfo binds the RequestInfo to the current TCP stream.
+void populateTCPRequestInfo(bool outbound, RequestInfo* request_info,
+                            const std::string& destination_namespace);
 
-  // HTTP URL related attributes.
-  std::string url_path;
-  std::string url_host;
-  std::string url_scheme;
+// RequestInfo represents the information collected from filter stream
+// callbacks. This is used to fill metrics and logs.
+//
+// Fields are fetched from the host on first access and kept for the rest of
+// the stream, so that plugins only pay for the attributes they use. Fields can
+// also be set explicitly, in which case they are never fetched.
+class RequestInfo {
+ public:
+  enum class Field : uint32_t {
+#define REQUEST_INFO_FIELD_ENUM(type, name, default_value) name,
+    REQUEST_INFO_FIELDS(REQUEST_INFO_FIELD_ENUM)
+#undef REQUEST_INFO_FIELD_ENUM
+  };
+
+#define REQUEST_INFO_FIELD_ACCESSORS(type, name, default_value) \
+  const type& name() const {                                    \
+    access(Field::name);                                        \
+    return name##_;                                             \
+  }                                                             \
+  void set_##name(const type& field) {                          \
+    name##_ = field;                                            \
+    set_ |= bit(Field::name);                                   \
+    fetched_ |= bit(Field::name);                               \
+  }
+  REQUEST_INFO_FIELDS(REQUEST_INFO_FIELD_ACCESSORS)
+#undef REQUEST_INFO_FIELD_ACCESSORS
+
+  // Comma separated names of the fields accessed so far, for debugging which
+  // attributes a configuration needs.
+  std::string accessedFields() const;
+
+  // Serializes the fields read so far along with the configuration they were
+  // read with.
+  void serialize(std::string* out) const;
+  // Takes the fields of a serialized RequestInfo that are not read yet. Fields
+  // that depend on the direction or the destination service configuration are
+  // only taken if it matches the one this RequestInfo is bound to.
+  void load(const FlatRequestInfo& shared);
 
   // TCP variables.
   int64_t tcp_connections_opened = 0;
@@ -145,6 +196,49 @@ struct RequestInfo {
   int64_t tcp_received_bytes = 0;
 
   bool is_populated = false;
+
+ private:
+  friend void populateHTTPRequestInfo(bool, bool, RequestInfo*,
+                                      const std::string&);
+  friend void populateTCPRequestInfo(bool, RequestInfo*, const std::string&);
+  friend void shareHTTPRequestInfo(const RequestInfo&);
+
+  // Stream the fields are read from.
+  enum class Source { None, HTTP, TCP };
+
+  static uint64_t bit(Field field) {
+    return uint64_t(1) << static_cast<uint32_t>(field);
+  }
+
+  void access(Field field) const {
+    accessed_ |= bit(field);
+    if ((fetched_ & bit(field)) == 0) {
+      fetch(field);
+    }
+  }
+
+  // Reads the field, and the fields obtained along with it, from the host.
+  void fetch(Field field) const;
+
+  // Resets the fields that were not set explicitly and binds them to a stream.
+  void bind(Source source, bool outbound, bool use_host_header_fallback,
+            const std::string& destination_namespace);
+
+#define REQUEST_INFO_FIELD_STORAGE(type, name, default_value) \
+  mutable type name##_{default_value};
+  REQUEST_INFO_FIELDS(REQUEST_INFO_FIELD_STORAGE)
+#undef REQUEST_INFO_FIELD_STORAGE
+
+  Source source_ = Source::None;
+  bool outbound_ = false;
+  bool use_host_header_fallback_ = false;
+  std::string destination_namespace_;
+  // Fields set explicitly.
+  uint64_t set_ = 0;
+  mutable uint64_t fetched_ = 0;
+  mutable uint64_t accessed_ = 0;
+  // Fields present in the shared RequestInfo.
+  uint64_t shared_ = 0;
 };
 
 // RequestContext contains all the information available in the request.
@@ -167,26 +261,34 @@ TrafficDirection getTrafficDirection();
 // Extract node info into a flatbuffer from a struct.
 bool extractNodeFlatBuffer(const google::protobuf::Struct& metadata,
                            flatbuffers::FlatBufferBuilder& fbb);
+// Extract node info into a flatbuffer from a serialized struct, without
+// parsing the struct. Returns false if the struct is malformed.
+bool extractNodeFlatBufferFromBytes(StringView metadata,
+                                    flatbuffers::FlatBufferBuilder& fbb);
+// Reads a length delimited google.protobuf.Struct at the current position of
+// input, calling read_entry with the key and the serialized Value of each
+// entry. They are views into the input buffer, unless they span buffers of
+// the input. A value is then copied into value_copy, which read_entry may
+// take, and value_copy is null otherwise. Returns false if the struct is
+// malformed or truncated, or if read_entry does.
+bool readStructEntries(
+    google::protobuf::io::CodedInputStream& input,
+    const std::function<bool(StringView key, StringView value,
+                             std::string* value_copy)>& read_entry);
+
+// Kinds of google.protobuf.Value read by readValueKind.
+enum class ValueKind { String, Struct };
+
+// Gets the string, or the serialized struct, of a serialized
+// google.protobuf.Value as a view into it. Returns false if the value is
+// malformed or of another kind.
+bool readValueKind(StringView value, ValueKind kind, StringView* out);
+
 // Extra local node metadata into a flatbuffer.
 bool extractLocalNodeFlatBuffer(std::string* out);
 // Convenience routine to create an empty node flatbuffer.
 void extractEmptyNodeFlatBuffer(std::string* out);
 
-// populateHTTPRequestInfo populates the RequestInfo struct. It needs access to
-// the request context.
-void populateHTTPRequestInfo(bool outbound, bool use_host_header,
-                             RequestInfo* request_info,
-                             const std::string& destination_namespace);
-
-// populateExtendedHTTPRequestInfo populates the extra fields in RequestInfo
-// struct, includes trace headers, request id headers, and url.
-void populateExtendedHTTPRequestInfo(RequestInfo* request_info);
-
-// populateTCPRequestInfo populates the RequestInfo struct. It needs access to
-// the request context.
-void populateTCPRequestInfo(bool outbound, RequestInfo* request_info,
-                            const std::string& destination_namespace);
-
 // Extracts node metadata value. It looks for values of all the keys
 // corresponding to EXCHANGE_KEYS in node_metadata and populates it in
 // google::protobuf::Value pointer that is passed in.
@@ -153,6 +153,107 @@ static void BM_WriteFlatBufferWithCache(benchmark::State& state) {
 }
 BENCHMARK(BM_WriteFlatBufferWithCache);
 
+static void BM_ParseStructToFlatBuffer(benchmark::State& state) {
+  google::protobuf::Struct metadata_struct;
+  JsonParseOptions json_parse_options;
+  JsonStringToMessage(std::string(node_metadata_json), &metadata_struct,
+                      json_parse_options);
+  auto bytes = metadata_struct.SerializeAsString();
+
+  for (auto _ : state) {
+    google::protobuf::Struct test_struct;
+    test_struct.ParseFromArray(bytes.data(), bytes.size());
+    flatbuffers::FlatBufferBuilder fbb;
+    extractNodeFlatBuffer(test_struct, fbb);
+    benchmark::DoNotOptimize(fbb.GetBufferPointer());
+  }
+}
+BENCHMARK(BM_ParseStructToFlatBuffer);
+
+static void BM_ReadStructBytesToFlatBuffer(benchmark::State& state) {
+  google::protobuf::Struct metadata_struct;
+  JsonParseOptions json_parse_options;
+  JsonStringToMessage(std::string(node_metadata_json), &metadata_struct,
+                      json_parse_options);
+  auto bytes = metadata_struct.SerializeAsString();
+
+  for (auto _ : state) {
+    flatbuffers::FlatBufferBuilder fbb;
+    extractNodeFlatBufferFromBytes(bytes, fbb);
+    benchmark::DoNotOptimize(fbb.GetBufferPointer());
+  }
+}
+BENCHMARK(BM_ReadStructBytesToFlatBuffer);
+
+// Attributes read by the stats plugin for every HTTP request.
+constexpr absl::string_view request_attributes[] = {
+    "request.protocol",  "response.code",       "response.grpc_status",
+    "response.flags",    "destination.service", "destination.service_name",
+    "connection.mtls",   "source.principal",    "destination.principal",
+    "request.size",      "response.total_size", "request.duration",
+    "destination.port",
+};
+
+// Stands in for a plugin reading the attributes of the request from the host,
+// one lookup and copy each.
+static void BM_ReadRequestAttributes(benchmark::State& state) {
+  Envoy::StreamInfo::FilterStateImpl filter_state{
+      Envoy::StreamInfo::FilterState::LifeSpan::TopSpan};
+  for (const auto& attribute : request_attributes) {
+    setData(filter_state, attribute, "outbound|9080||svc.ns.svc.cluster.local");
+  }
+
+  size_t size = 0;
+  for (auto _ : state) {
+    for (const auto& attribute : request_attributes) {
+      std::string value = getData(filter_state, attribute);
+      size += value.size();
+    }
+    benchmark::DoNotOptimize(size);
+  }
+}
+BENCHMARK(BM_ReadRequestAttributes);
+
+// A plugin sharing the same attributes through the filter state and another
+// plugin loading them, as done with share_request_info set. Sharing is a net
+// win when this is faster than BM_ReadRequestAttributes.
+static void BM_ShareRequestInfo(benchmark::State& state) {
+  Envoy::StreamInfo::FilterStateImpl filter_state{
+      Envoy::StreamInfo::FilterState::LifeSpan::TopSpan};
+  RequestInfo request_info;
+  request_info.set_request_protocol("http");
+  request_info.set_response_code(200);
+  request_info.set_grpc_status(0);
+  request_info.set_response_flag("-");
+  request_info.set_destination_service_host("svc.ns.svc.cluster.local");
+  request_info.set_destination_service_name("svc");
+  request_info.set_service_auth_policy(ServiceAuthenticationPolicy::MutualTLS);
+  request_info.set_source_principal("spiffe://cluster.local/ns/ns/sa/client");
+  request_info.set_destination_principal(
+      "spiffe://cluster.local/ns/ns/sa/server");
+  request_info.set_request_size(1024);
+  request_info.set_response_size(2048);
+  request_info.set_duration(1000000);
+  request_info.set_destination_port(9080);
+
+  for (auto _ : state) {
+    std::string shared;
+    request_info.serialize(&shared);
+    setData(filter_state, kRequestInfoKey, shared);
+
+    std::string loaded_shared = getData(filter_state, kRequestInfoKey);
+    flatbuffers::Verifier verifier(
+        reinterpret_cast<const uint8_t*>(loaded_shared.data()),
+        loaded_shared.size());
+    RequestInfo loaded;
+    if (VerifyFlatRequestInfoBuffer(verifier)) {
+      loaded.load(*GetFlatRequestInfo(loaded_shared.data()));
+    }
+    benchmark::DoNotOptimize(loaded.response_code());
+  }
+}
+BENCHMARK(BM_ShareRequestInfo);
+
 }  // namespace Common
 
 // WASM_EPILOG
@@ -68,6 +68,56 @@ TEST(ContextTest, extractNodeMetadata) {
   EXPECT_EQ(peer->app_containers()->size(), 2);
 }
 
+// Test that reading a serialized struct gives the same node as the struct.
+TEST(ContextTest, extractNodeMetadataFromBytes) {
+  google::protobuf::Struct metadata_struct;
+  JsonParseOptions json_parse_options;
+  JsonStringToMessage(std::string(node_metadata_json), &metadata_struct,
+                      json_parse_options);
+  (*(*metadata_struct.mutable_fields())["LABELS"]
+        .mutable_struct_value()
+        ->mutable_fields())["app"]
+      .set_string_value("test_app");
+  (*metadata_struct.mutable_fields())["OTHER"].set_number_value(1);
+  const auto bytes = metadata_struct.SerializeAsString();
+
+  flatbuffers::FlatBufferBuilder expected_fbb(1024);
+  EXPECT_TRUE(extractNodeFlatBuffer(metadata_struct, expected_fbb));
+  flatbuffers::FlatBufferBuilder fbb(1024);
+  EXPECT_TRUE(extractNodeFlatBufferFromBytes(bytes, fbb));
+  auto expected =
+      flatbuffers::GetRoot<FlatNode>(expected_fbb.GetBufferPointer());
+  auto peer = flatbuffers::GetRoot<FlatNode>(fbb.GetBufferPointer());
+  EXPECT_EQ(peer->name()->string_view(), expected->name()->string_view());
+  EXPECT_EQ(peer->namespace_()->string_view(),
+            expected->namespace_()->string_view());
+  EXPECT_EQ(peer->owner()->string_view(), expected->owner()->string_view());
+  EXPECT_EQ(peer->workload_name()->string_view(),
+            expected->workload_name()->string_view());
+  EXPECT_EQ(peer->labels()->LookupByKey("app")->value()->string_view(),
+            "test_app");
+  ASSERT_EQ(peer->platform_metadata()->size(),
+            expected->platform_metadata()->size());
+  for (flatbuffers::uoffset_t i = 0; i < peer->platform_metadata()->size();
+       i++) {
+    EXPECT_EQ(peer->platform_metadata()->Get(i)->key()->string_view(),
+              expected->platform_metadata()->Get(i)->key()->string_view());
+    EXPECT_EQ(peer->platform_metadata()->Get(i)->value()->string_view(),
+              expected->platform_metadata()->Get(i)->value()->string_view());
+  }
+  ASSERT_EQ(peer->app_containers()->size(), 2);
+  EXPECT_EQ(peer->app_containers()->Get(1)->string_view(), "hello");
+
+  // Truncated structs are rejected.
+  for (size_t size = 1; size < bytes.size(); size++) {
+    flatbuffers::FlatBufferBuilder truncated_fbb;
+    google::protobuf::Struct truncated;
+    EXPECT_EQ(extractNodeFlatBufferFromBytes(
+                  StringView(bytes.data(), size), truncated_fbb),
+              truncated.ParseFromArray(bytes.data(), size));
+  }
+}
+
 // Test extractNodeMetadataValue.
 TEST(ContextTest, extractNodeMetadataValue) {
   google::protobuf::Struct metadata_struct;
@@ -86,6 +136,47 @@ TEST(ContextTest, extractNodeMetadataValue) {
   EXPECT_EQ(label_iter->second.string_value(), "{app, details}");
 }
 
+// Test that fields of an unbound RequestInfo are not fetched and that accesses
+// are tracked.
+TEST(ContextTest, RequestInfoAccessedFields) {
+  RequestInfo request_info;
+  request_info.set_request_id("123");
+  EXPECT_EQ(request_info.accessedFields(), "");
+  EXPECT_EQ(request_info.request_id(), "123");
+  EXPECT_EQ(request_info.response_code(), 0);
+  EXPECT_EQ(request_info.grpc_status(), 2);
+  EXPECT_EQ(request_info.accessedFields(),
+            "response_code,grpc_status,request_id");
+}
+
+// Test sharing the fields read by a RequestInfo with another RequestInfo.
+TEST(ContextTest, RequestInfoShared) {
+  RequestInfo request_info;
+  request_info.set_response_code(503);
+  request_info.set_request_id("123");
+  request_info.set_destination_service_host("svc.ns.svc.cluster.local");
+  request_info.set_service_auth_policy(
+      ServiceAuthenticationPolicy::MutualTLS);
+  std::string shared;
+  request_info.serialize(&shared);
+
+  flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t*>(shared.data()), shared.size());
+  EXPECT_TRUE(VerifyFlatRequestInfoBuffer(verifier));
+
+  RequestInfo loaded;
+  loaded.set_request_id("456");
+  loaded.load(*GetFlatRequestInfo(shared.data()));
+  EXPECT_EQ(loaded.response_code(), 503);
+  EXPECT_EQ(loaded.request_id(), "456");
+  EXPECT_EQ(loaded.destination_service_host(), "svc.ns.svc.cluster.local");
+  EXPECT_EQ(loaded.service_auth_policy(),
+            ServiceAuthenticationPolicy::MutualTLS);
+  EXPECT_EQ(loaded.accessedFields(),
+            "response_code,destination_service_host,service_auth_policy,"
+            "request_id");
+}
+
 }  // namespace Common
 
 // WASM_EPILOG
@@ -13,7 +13,10 @@
  * limitations under the License.
  */
 
+#include "extensions/common/util.h"
+
 #include <string>
+#include <unordered_map>
 
 namespace Wasm {
 namespace Common {
@@ -68,102 +71,85 @@ enum ResponseFlag {
   LastFlag = DownstreamProtocolError
 };
 
-void appendString(std::string& result, const std::string& append) {
-  if (result.empty()) {
-    result = append;
-  } else {
-    result += "," + append;
-  }
-}
-
-}  // namespace
-
-const std::string parseResponseFlag(uint64_t response_flag) {
-  std::string result;
-
-  if (response_flag & FailedLocalHealthCheck) {
-    appendString(result, FAILED_LOCAL_HEALTH_CHECK);
-  }
-
-  if (response_flag & NoHealthyUpstream) {
-    appendString(result, NO_HEALTHY_UPSTREAM);
-  }
-
-  if (response_flag & UpstreamRequestTimeout) {
-    appendString(result, UPSTREAM_REQUEST_TIMEOUT);
-  }
-
-  if (response_flag & LocalReset) {
-    appendString(result, LOCAL_RESET);
-  }
-
-  if (response_flag & UpstreamRemoteReset) {
-    appendString(result, UPSTREAM_REMOTE_RESET);
-  }
-
-  if (response_flag & UpstreamConnectionFailure) {
-    appendString(result, UPSTREAM_CONNECTION_FAILURE);
-  }
-
-  if (response_flag & UpstreamConnectionTermination) {
-    appendString(result, UPSTREAM_CONNECTION_TERMINATION);
-  }
-
-  if (response_flag & UpstreamOverflow) {
-    appendString(result, UPSTREAM_OVERFLOW);
-  }
-
-  if (response_flag & NoRouteFound) {
-    appendString(result, NO_ROUTE_FOUND);
-  }
-
-  if (response_flag & DelayInjected) {
-    appendString(result, DELAY_INJECTED);
-  }
-
-  if (response_flag & FaultInjected) {
-    appendString(result, FAULT_INJECTED);
-  }
+// Flag names in the order they are joined.
+const std::pair<uint64_t, const std::string*> FLAG_NAMES[] = {
+    {FailedLocalHealthCheck, &FAILED_LOCAL_HEALTH_CHECK},
+    {NoHealthyUpstream, &NO_HEALTHY_UPSTREAM},
+    {UpstreamRequestTimeout, &UPSTREAM_REQUEST_TIMEOUT},
+    {LocalReset, &LOCAL_RESET},
+    {UpstreamRemoteReset, &UPSTREAM_REMOTE_RESET},
+    {UpstreamConnectionFailure, &UPSTREAM_CONNECTION_FAILURE},
+    {UpstreamConnectionTermination, &UPSTREAM_CONNECTION_TERMINATION},
+    {UpstreamOverflow, &UPSTREAM_OVERFLOW},
+    {NoRouteFound, &NO_ROUTE_FOUND},
+    {DelayInjected, &DELAY_INJECTED},
+    {FaultInjected, &FAULT_INJECTED},
+    {RateLimited, &RATE_LIMITED},
+    {UnauthorizedExternalService, &UNAUTHORIZED_EXTERNAL_SERVICE},
+    {RateLimitServiceError, &RATELIMIT_SERVICE_ERROR},
+    {DownstreamConnectionTermination, &DOWNSTREAM_CONNECTION_TERMINATION},
+    {UpstreamRetryLimitExceeded, &UPSTREAM_RETRY_LIMIT_EXCEEDED},
+    {StreamIdleTimeout, &STREAM_IDLE_TIMEOUT},
+    {InvalidEnvoyRequestHeaders, &INVALID_ENVOY_REQUEST_HEADERS},
+    {DownstreamProtocolError, &DOWNSTREAM_PROTOCOL_ERROR},
+};
 
-  if (response_flag & RateLimited) {
-    appendString(result, RATE_LIMITED);
-  }
+// Maximum number of flag combinations memoized per thread.
+constexpr size_t kMaxCachedResponseFlags = 64;
 
-  if (response_flag & UnauthorizedExternalService) {
-    appendString(result, UNAUTHORIZED_EXTERNAL_SERVICE);
+void appendString(std::string& result, const std::string& append) {
+  if (!result.empty()) {
+    result += ",";
   }
+  result += append;
+}
 
-  if (response_flag & RateLimitServiceError) {
-    appendString(result, RATELIMIT_SERVICE_ERROR);
+void buildResponseFlag(uint64_t response_flag, std::string& result) {
+  result.clear();
+  for (const auto& flag : FLAG_NAMES) {
+    if (response_flag & flag.first) {
+      appendString(result, *flag.second);
+    }
   }
 
-  if (response_flag & DownstreamConnectionTermination) {
-    appendString(result, DOWNSTREAM_CONNECTION_TERMINATION);
+  if (response_flag >= (LastFlag << 1)) {
+    // Response flag integer overflows. Append the integer to avoid information
+    // loss.
+    appendString(result, std::to_string(response_flag));
   }
+}
 
-  if (response_flag & UpstreamRetryLimitExceeded) {
-    appendString(result, UPSTREAM_RETRY_LIMIT_EXCEEDED);
-  }
+}  // namespace
 
-  if (response_flag & StreamIdleTimeout) {
-    appendString(result, STREAM_IDLE_TIMEOUT);
+absl::string_view parseResponseFlag(uint64_t response_flag) {
+  if (response_flag == 0) {
+    return NONE;
   }
 
-  if (response_flag & InvalidEnvoyRequestHeaders) {
-    appendString(result, INVALID_ENVOY_REQUEST_HEADERS);
+  // A single flag is the common case for failed requests.
+  if ((response_flag & (response_flag - 1)) == 0) {
+    for (const auto& flag : FLAG_NAMES) {
+      if (flag.first == response_flag) {
+        return *flag.second;
+      }
+    }
   }
 
-  if (response_flag & DownstreamProtocolError) {
-    appendString(result, DOWNSTREAM_PROTOCOL_ERROR);
+  // Combinations are few in practice, so memoize the first ones seen. Entries
+  // are never erased, which keeps the returned views valid.
+  static thread_local std::unordered_map<uint64_t, std::string> cache;
+  auto it = cache.find(response_flag);
+  if (it != cache.end()) {
+    return it->second;
   }
-
-  if (response_flag >= (LastFlag << 1)) {
-    // Response flag integer overflows. Append the integer to avoid information
-    // loss.
-    appendString(result, std::to_string(response_flag));
+  if (cache.size() < kMaxCachedResponseFlags) {
+    auto& result = cache[response_flag];
+    buildResponseFlag(response_flag, result);
+    return result;
   }
-
-  return result.empty() ? NONE : result;
+  static thread_local std::string scratch;
+  buildResponseFlag(response_flag, scratch);
+  return scratch;
 }
 
 }  // namespace Common
@@ -17,11 +17,16 @@
 
 #include <string>
 
+#include "absl/strings/string_view.h"
+
 namespace Wasm {
 namespace Common {
 
-// Parses an integer response flag into a readable short string.
-const std::string parseResponseFlag(uint64_t response_flag);
+// Parses an integer response flag into a readable short string. The returned
+// view points into storage owned by this function. It stays valid for the
+// lifetime of the thread, except for rare flag combinations beyond the
+// memoized set, which are only valid until the next call on the same thread.
+absl::string_view parseResponseFlag(uint64_t response_flag);
 
 }  // namespace Common
 }  // namespace Wasm
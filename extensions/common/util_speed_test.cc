@@ -0,0 +1,69 @@
+/* Copyright 2020 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "benchmark/benchmark.h"
+#include "extensions/common/util.h"
+
+namespace Wasm {
+namespace Common {
+
+static void BM_ParseResponseFlagNone(benchmark::State& state) {
+  size_t size = 0;
+  for (auto _ : state) {
+    size += parseResponseFlag(0x0).size();
+    benchmark::DoNotOptimize(size);
+  }
+}
+BENCHMARK(BM_ParseResponseFlagNone);
+
+static void BM_ParseResponseFlagSingle(benchmark::State& state) {
+  size_t size = 0;
+  for (auto _ : state) {
+    size += parseResponseFlag(0x20).size();
+    benchmark::DoNotOptimize(size);
+  }
+}
+BENCHMARK(BM_ParseResponseFlagSingle);
+
+static void BM_ParseResponseFlagCombination(benchmark::State& state) {
+  size_t size = 0;
+  for (auto _ : state) {
+    size += parseResponseFlag(0x604).size();
+    benchmark::DoNotOptimize(size);
+  }
+}
+BENCHMARK(BM_ParseResponseFlagCombination);
+
+static void BM_ParseResponseFlagOverflow(benchmark::State& state) {
+  size_t size = 0;
+  for (auto _ : state) {
+    size += parseResponseFlag(0xC0000).size();
+    benchmark::DoNotOptimize(size);
+  }
+}
+BENCHMARK(BM_ParseResponseFlagOverflow);
+
+}  // namespace Common
+}  // namespace Wasm
+
+// Boilerplate main(), which discovers benchmarks in the same file and runs
+// them.
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+}
@@ -51,6 +51,25 @@ TEST(WasmCommonUtilsTest, ParseResponseFlag) {
   { EXPECT_EQ("DPE,786432", parseResponseFlag(0xC0000)); }
 }
 
+TEST(WasmCommonUtilsTest, ParseResponseFlagCombinations) {
+  // Memoized combinations keep returning the same storage.
+  EXPECT_EQ(parseResponseFlag(0x30).data(), parseResponseFlag(0x30).data());
+
+  // Combinations beyond the memoized set are still parsed correctly.
+  for (uint64_t flag = 0x3; flag < 0x3000; flag += 0x10) {
+    std::string expected;
+    for (uint64_t bit = 1; bit <= flag; bit <<= 1) {
+      if (flag & bit) {
+        if (!expected.empty()) {
+          expected += ",";
+        }
+        expected += std::string(parseResponseFlag(bit));
+      }
+    }
+    EXPECT_EQ(expected, parseResponseFlag(flag));
+  }
+}
+
 }  // namespace
 }  // namespace Common
 }  // namespace Wasm
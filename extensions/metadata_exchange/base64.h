@@ -18,7 +18,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 class Base64 {
  public:
@@ -48,151 +50,93 @@ inline constexpr unsigned char REVERSE_LOOKUP_TABLE[256] = {
     64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64};
 // clang-format on
 
-inline bool decodeBase(const uint8_t cur_char, uint64_t pos, std::string& ret,
-                       const unsigned char* const reverse_lookup_table) {
-  const unsigned char c = reverse_lookup_table[static_cast<uint32_t>(cur_char)];
-  if (c == 64) {
-    // Invalid character
-    return false;
-  }
-
-  switch (pos % 4) {
-    case 0:
-      ret.push_back(c << 2);
-      break;
-    case 1:
-      ret.back() |= c >> 4;
-      ret.push_back(c << 4);
-      break;
-    case 2:
-      ret.back() |= c >> 2;
-      ret.push_back(c << 6);
-      break;
-    case 3:
-      ret.back() |= c;
-      break;
-  }
-  return true;
-}
-
-inline bool decodeLast(const uint8_t cur_char, uint64_t pos, std::string& ret,
-                       const unsigned char* const reverse_lookup_table) {
-  const unsigned char c = reverse_lookup_table[static_cast<uint32_t>(cur_char)];
-  if (c == 64) {
-    // Invalid character
-    return false;
-  }
-
-  switch (pos % 4) {
-    case 0:
-      return false;
-    case 1:
-      ret.back() |= c >> 4;
-      return (c & 0b1111) == 0;
-    case 2:
-      ret.back() |= c >> 2;
-      return (c & 0b11) == 0;
-    case 3:
-      ret.back() |= c;
-      break;
-  }
-  return true;
-}
-
-inline void encodeBase(const uint8_t cur_char, uint64_t pos, uint8_t& next_c,
-                       std::string& ret, const char* const char_table) {
-  switch (pos % 3) {
-    case 0:
-      ret.push_back(char_table[cur_char >> 2]);
-      next_c = (cur_char & 0x03) << 4;
-      break;
-    case 1:
-      ret.push_back(char_table[next_c | (cur_char >> 4)]);
-      next_c = (cur_char & 0x0f) << 2;
-      break;
-    case 2:
-      ret.push_back(char_table[next_c | (cur_char >> 6)]);
-      ret.push_back(char_table[cur_char & 0x3f]);
-      next_c = 0;
-      break;
-  }
-}
-
-inline void encodeLast(uint64_t pos, uint8_t last_char, std::string& ret,
-                       const char* const char_table, bool add_padding) {
-  switch (pos % 3) {
-    case 1:
-      ret.push_back(char_table[last_char]);
-      if (add_padding) {
-        ret.push_back('=');
-        ret.push_back('=');
-      }
-      break;
-    case 2:
-      ret.push_back(char_table[last_char]);
-      if (add_padding) {
-        ret.push_back('=');
-      }
-      break;
-    default:
-      break;
-  }
-}
+// The codec works on whole blocks of 3 bytes and 4 characters, writing into
+// a string sized upfront, instead of byte by byte.
 
 inline std::string Base64::encode(const char* input, uint64_t length,
                                   bool add_padding) {
-  uint64_t output_length = (length + 2) / 3 * 4;
-  std::string ret;
-  ret.reserve(output_length);
-
-  uint64_t pos = 0;
-  uint8_t next_c = 0;
-
-  for (uint64_t i = 0; i < length; ++i) {
-    encodeBase(input[i], pos++, next_c, ret, CHAR_TABLE);
+  const uint64_t remainder = length % 3;
+  uint64_t output_length = length / 3 * 4;
+  if (remainder != 0) {
+    output_length += add_padding ? 4 : remainder + 1;
+  }
+  std::string ret(output_length, '=');
+  const auto* in = reinterpret_cast<const uint8_t*>(input);
+  char* out = &ret[0];
+
+  const uint64_t blocks_end = length - remainder;
+  for (uint64_t i = 0; i < blocks_end; i += 3, out += 4) {
+    const uint32_t block = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+    out[0] = CHAR_TABLE[block >> 18];
+    out[1] = CHAR_TABLE[(block >> 12) & 0x3f];
+    out[2] = CHAR_TABLE[(block >> 6) & 0x3f];
+    out[3] = CHAR_TABLE[block & 0x3f];
   }
 
-  encodeLast(pos, next_c, ret, CHAR_TABLE, add_padding);
-
+  // The padding characters are already in place.
+  if (remainder == 1) {
+    const uint32_t block = in[blocks_end] << 16;
+    out[0] = CHAR_TABLE[block >> 18];
+    out[1] = CHAR_TABLE[(block >> 12) & 0x3f];
+  } else if (remainder == 2) {
+    const uint32_t block = in[blocks_end] << 16 | in[blocks_end + 1] << 8;
+    out[0] = CHAR_TABLE[block >> 18];
+    out[1] = CHAR_TABLE[(block >> 12) & 0x3f];
+    out[2] = CHAR_TABLE[(block >> 6) & 0x3f];
+  }
   return ret;
 }
 
-inline std::string Base64::decodeWithoutPadding(StringView input) {
-  if (input.empty()) {
-    return EMPTY_STRING;
-  }
-
+inline std::string Base64::decodeWithoutPadding(std::string_view input) {
   // At most last two chars can be '='.
   size_t n = input.length();
-  if (input[n - 1] == '=') {
+  if (n > 0 && input[n - 1] == '=') {
     n--;
     if (n > 0 && input[n - 1] == '=') {
       n--;
     }
   }
-  // Last position before "valid" padding character.
-  uint64_t last = n - 1;
-  // Determine output length.
-  size_t max_length = (n + 3) / 4 * 3;
-  if (n % 4 == 3) {
-    max_length -= 1;
-  }
-  if (n % 4 == 2) {
-    max_length -= 2;
+  const size_t remainder = n % 4;
+  if (n == 0 || remainder == 1) {
+    return {};
   }
 
-  std::string ret;
-  ret.reserve(max_length);
-  for (uint64_t i = 0; i < last; ++i) {
-    if (!decodeBase(input[i], i, ret, REVERSE_LOOKUP_TABLE)) {
-      return EMPTY_STRING;
+  std::string ret(n / 4 * 3 + (remainder == 0 ? 0 : remainder - 1), '\0');
+  const auto* in = reinterpret_cast<const uint8_t*>(input.data());
+  char* out = &ret[0];
+
+  // Invalid characters map to 64, which is the only value with bit 6 set.
+  const size_t blocks_end = n - remainder;
+  for (size_t i = 0; i < blocks_end; i += 4, out += 3) {
+    const uint32_t a = REVERSE_LOOKUP_TABLE[in[i]];
+    const uint32_t b = REVERSE_LOOKUP_TABLE[in[i + 1]];
+    const uint32_t c = REVERSE_LOOKUP_TABLE[in[i + 2]];
+    const uint32_t d = REVERSE_LOOKUP_TABLE[in[i + 3]];
+    if ((a | b | c | d) & 64) {
+      return {};
     }
+    const uint32_t block = a << 18 | b << 12 | c << 6 | d;
+    out[0] = static_cast<char>(block >> 16);
+    out[1] = static_cast<char>(block >> 8);
+    out[2] = static_cast<char>(block);
   }
 
-  if (!decodeLast(input[last], last, ret, REVERSE_LOOKUP_TABLE)) {
-    return EMPTY_STRING;
+  if (remainder == 0) {
+    return ret;
+  }
+  const uint32_t a = REVERSE_LOOKUP_TABLE[in[blocks_end]];
+  const uint32_t b = REVERSE_LOOKUP_TABLE[in[blocks_end + 1]];
+  const uint32_t c =
+      remainder == 3 ? REVERSE_LOOKUP_TABLE[in[blocks_end + 2]] : 0;
+  // The bits of the last character beyond the input must be zero.
+  if ((a | b | c) & 64 || (remainder == 2 && (b & 0b1111) != 0) ||
+      (remainder == 3 && (c & 0b11) != 0)) {
+    return {};
+  }
+  const uint32_t block = a << 18 | b << 12 | c << 6;
+  out[0] = static_cast<char>(block >> 16);
+  if (remainder == 3) {
+    out[1] = static_cast<char>(block >> 8);
   }
-
-  ASSERT(ret.size() == max_length);
   return ret;
 }
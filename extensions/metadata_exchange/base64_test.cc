@@ -0,0 +1,147 @@
+/* Copyright 2020 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "extensions/metadata_exchange/base64.h"
+
+#include <random>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// The character at a time decoder replaced by the block decoder, as the
+// reference for the inputs to reject.
+std::string referenceDecode(std::string_view input) {
+  size_t n = input.length();
+  if (n > 0 && input[n - 1] == '=') {
+    n--;
+    if (n > 0 && input[n - 1] == '=') {
+      n--;
+    }
+  }
+  if (n == 0) {
+    return {};
+  }
+  std::string ret;
+  for (size_t i = 0; i < n; ++i) {
+    const unsigned char c =
+        REVERSE_LOOKUP_TABLE[static_cast<uint8_t>(input[i])];
+    if (c == 64) {
+      return {};
+    }
+    const bool last = i == n - 1;
+    switch (i % 4) {
+      case 0:
+        if (last) {
+          return {};
+        }
+        ret.push_back(c << 2);
+        break;
+      case 1:
+        ret.back() |= c >> 4;
+        if (last) {
+          return (c & 0b1111) == 0 ? ret : std::string();
+        }
+        ret.push_back(c << 4);
+        break;
+      case 2:
+        ret.back() |= c >> 2;
+        if (last) {
+          return (c & 0b11) == 0 ? ret : std::string();
+        }
+        ret.push_back(c << 6);
+        break;
+      case 3:
+        ret.back() |= c;
+        break;
+    }
+  }
+  return ret;
+}
+
+// Test encoding and decoding random bytes of every length up to a few blocks.
+TEST(Base64Test, RoundTrip) {
+  std::mt19937 random(42);
+  for (size_t length = 0; length <= 64; length++) {
+    std::string bytes(length, '\0');
+    for (auto& c : bytes) {
+      c = static_cast<char>(random());
+    }
+    const auto padded = Base64::encode(bytes.data(), bytes.size());
+    const auto unpadded = Base64::encode(bytes.data(), bytes.size(), false);
+    EXPECT_EQ(padded.size(), (length + 2) / 3 * 4);
+    EXPECT_EQ(unpadded.size(), (length * 4 + 2) / 3);
+    EXPECT_EQ(Base64::decodeWithoutPadding(padded), bytes);
+    EXPECT_EQ(Base64::decodeWithoutPadding(unpadded), bytes);
+  }
+}
+
+// Test the padding variants of the inputs that do not fill the last block.
+TEST(Base64Test, Padding) {
+  EXPECT_EQ(Base64::encode("f", 1), "Zg==");
+  EXPECT_EQ(Base64::encode("f", 1, false), "Zg");
+  EXPECT_EQ(Base64::encode("fo", 2), "Zm8=");
+  EXPECT_EQ(Base64::encode("fo", 2, false), "Zm8");
+  EXPECT_EQ(Base64::encode("foo", 3), "Zm9v");
+  EXPECT_EQ(Base64::encode("foo", 3, false), "Zm9v");
+
+  EXPECT_EQ(Base64::decodeWithoutPadding("Zg=="), "f");
+  EXPECT_EQ(Base64::decodeWithoutPadding("Zg="), "f");
+  EXPECT_EQ(Base64::decodeWithoutPadding("Zg"), "f");
+  EXPECT_EQ(Base64::decodeWithoutPadding("Zm8="), "fo");
+  EXPECT_EQ(Base64::decodeWithoutPadding("Zm8"), "fo");
+  EXPECT_EQ(Base64::decodeWithoutPadding("Zm9vYg=="), "foob");
+  EXPECT_EQ(Base64::decodeWithoutPadding("Zm9vYmE"), "fooba");
+}
+
+// Test that invalid inputs decode to an empty string.
+TEST(Base64Test, Invalid) {
+  for (const std::string_view input :
+       {"", "=", "==", "===", "Z", "Z=", "Z==", "Zm9vY", "Zm9vY===", "Zh",
+        "Zh==", "Zm9", "Zm9=", "Zg=a", "Z=g=", "Zm 9v", "Zm9v!", "Zm9v\n",
+        "Zm-_"}) {
+    EXPECT_EQ(Base64::decodeWithoutPadding(input), "") << input;
+  }
+  const std::string_view nul("Zm\09v", 5);
+  EXPECT_EQ(Base64::decodeWithoutPadding(nul), "");
+}
+
+// Test that every short string over valid, padding and invalid characters
+// decodes the same as with the reference decoder.
+TEST(Base64Test, MatchesReference) {
+  const std::string alphabet = "AQgw+/=!\x80";
+  std::string input;
+  std::vector<size_t> digits;
+  for (size_t length = 0; length <= 6; length++) {
+    digits.assign(length, 0);
+    while (true) {
+      input.clear();
+      for (size_t digit : digits) {
+        input.push_back(alphabet[digit]);
+      }
+      ASSERT_EQ(Base64::decodeWithoutPadding(input), referenceDecode(input))
+          << input;
+      size_t i = 0;
+      while (i < length && ++digits[i] == alphabet.size()) {
+        digits[i++] = 0;
+      }
+      if (i == length) {
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace
@@ -17,6 +17,7 @@
 
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 
+#include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
 #include "extensions/metadata_exchange/config.pb.h"
@@ -28,7 +29,7 @@
 
 #else
 
-#include "common/common/base64.h"
+#include "extensions/metadata_exchange/base64.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -59,6 +60,43 @@ bool serializeToStringDeterministic(const google::protobuf::Message& metadata,
   return true;
 }
 
+// FNV-1a hash, which is stable across builds, as peers may run different
+// ones.
+uint64_t fnv1a(StringView bytes) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : bytes) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Hash of the serialized metadata or of a peer metadata header.
+std::string hashMetadata(StringView metadata_bytes) {
+  return absl::StrCat(absl::Hex(fnv1a(metadata_bytes), absl::kZeroPad16));
+}
+
+// Decodes a peer metadata header value into a peer flat buffer.
+bool decodePeer(StringView peer_header, std::string* out) {
+  const std::string_view header(peer_header.data(), peer_header.size());
+  if (absl::StartsWith(peer_header, FlatMetadataPrefix)) {
+    // the peer sent the flat buffer, store it as-is once verified.
+    *out = ::Base64::decodeWithoutPadding(
+        header.substr(FlatMetadataPrefix.size()));
+    flatbuffers::Verifier verifier(
+        reinterpret_cast<const uint8_t*>(out->data()), out->size());
+    return ::Wasm::Common::VerifyFlatNodeBuffer(verifier);
+  }
+  auto bytes = ::Base64::decodeWithoutPadding(header);
+  flatbuffers::FlatBufferBuilder fbb;
+  if (!::Wasm::Common::extractNodeFlatBufferFromBytes(bytes, fbb)) {
+    return false;
+  }
+  out->assign(reinterpret_cast<const char*>(fbb.GetBufferPointer()),
+              fbb.GetSize());
+  return true;
+}
+
 }  // namespace
 
 static RegisterContextFactory register_MetadataExchange(
@@ -91,7 +129,18 @@ void PluginRootContext::updateMetadataValue() {
   std::string metadata_bytes;
   serializeToStringDeterministic(metadata, &metadata_bytes);
   metadata_value_ =
-      Base64::encode(metadata_bytes.data(), metadata_bytes.size());
+      ::Base64::encode(metadata_bytes.data(), metadata_bytes.size());
+  // the hash does not depend on the encoding of the header.
+  metadata_hash_ = hashMetadata(metadata_bytes);
+
+  flatbuffers::FlatBufferBuilder fbb;
+  if (!::Wasm::Common::extractNodeFlatBuffer(metadata, fbb)) {
+    return;
+  }
+  flat_metadata_value_ = absl::StrCat(
+      FlatMetadataPrefix,
+      ::Base64::encode(reinterpret_cast<const char*>(fbb.GetBufferPointer()),
+                       fbb.GetSize()));
 }
 
 bool PluginRootContext::onConfigure(size_t) {
@@ -117,48 +166,176 @@ bool PluginRootContext::onConfigure(size_t) {
   if (config.has_max_peer_cache_size()) {
     max_peer_cache_size_ = config.max_peer_cache_size().value();
   }
+  if (config.has_max_shared_peer_cache_size()) {
+    max_shared_peer_cache_size_ = config.max_shared_peer_cache_size().value();
+  }
+  send_flat_metadata_ =
+      config.send_flat_metadata() && !flat_metadata_value_.empty();
+  compact_metadata_ = config.compact_metadata() && !metadata_hash_.empty();
   return true;
 }
 
 bool PluginRootContext::updatePeer(StringView key, StringView peer_id,
-                                   StringView peer_header) {
+                                   StringView peer_hash,
+                                   StringView peer_header, std::string* peer) {
   std::string id = std::string(peer_id);
+  // a peer may reuse its ID with new metadata, so the cached peers are also
+  // told apart by the hash of their metadata, or else by their header, which
+  // is cheaper to compare than to hash.
+  auto it = cache_.end();
   if (max_peer_cache_size_ > 0) {
-    auto it = cache_.find(id);
-    if (it != cache_.end()) {
-      setFilterState(key, it->second);
+    it = cache_.find(id);
+    if (it != cache_.end() &&
+        (peer_hash.empty()
+             ? it->second->hash.empty() && it->second->header == peer_header
+             : it->second->hash == peer_hash)) {
+      cache_list_.splice(cache_list_.begin(), cache_list_, it->second);
+      setFilterState(key, it->second->peer);
+      if (peer != nullptr) {
+        *peer = it->second->peer;
+      }
+      cache_hits_accumulator_++;
+      if (cache_hits_accumulator_ == 100) {
+        incrementMetric(cache_hits_, cache_hits_accumulator_);
+        cache_hits_accumulator_ = 0;
+      }
       return true;
     }
+    incrementMetric(cache_misses_, 1);
   }
 
-  auto bytes = Base64::decodeWithoutPadding(peer_header);
-  google::protobuf::Struct metadata;
-  if (!metadata.ParseFromString(bytes)) {
-    return false;
+  std::string out;
+  const bool shared = max_shared_peer_cache_size_ > 0 && !id.empty();
+  std::string shared_key;
+  if (shared) {
+    // peers that sent no hash are only hashed on a cache miss.
+    shared_key = peer_hash.empty()
+                     ? absl::StrCat(id, "/", hashMetadata(peer_header))
+                     : absl::StrCat(id, "/", peer_hash);
   }
-
-  flatbuffers::FlatBufferBuilder fbb;
-  if (!::Wasm::Common::extractNodeFlatBuffer(metadata, fbb)) {
-    return false;
+  if (!shared || !getSharedPeer(shared_key, &out)) {
+    if (peer_header.empty() || !decodePeer(peer_header, &out)) {
+      return false;
+    }
+    if (shared) {
+      setSharedPeer(shared_key, out);
+    }
   }
-  StringView out(reinterpret_cast<const char*>(fbb.GetBufferPointer()),
-                 fbb.GetSize());
   setFilterState(key, out);
+  if (peer != nullptr) {
+    *peer = out;
+  }
 
   if (max_peer_cache_size_ > 0) {
-    // do not let the cache grow beyond max cache size.
-    if (static_cast<uint32_t>(cache_.size()) > max_peer_cache_size_) {
-      auto it = cache_.begin();
-      cache_.erase(cache_.begin(), std::next(it, max_peer_cache_size_ / 4));
-      logDebug(absl::StrCat("cleaned cache, new cache_size:", cache_.size()));
+    // the peer changed its metadata since it was cached.
+    if (it != cache_.end()) {
+      cache_list_.erase(it->second);
+      cache_.erase(it);
     }
-    cache_.emplace(std::move(id), out);
+    // do not let the cache grow beyond max cache size, evicting the least
+    // recently used peers.
+    while (cache_list_.size() >= max_peer_cache_size_) {
+      cache_.erase(cache_list_.back().id);
+      cache_list_.pop_back();
+      incrementMetric(cache_evictions_, 1);
+    }
+    cache_list_.push_front(PeerCacheEntry{
+        id, std::string(peer_hash),
+        peer_hash.empty() ? std::string(peer_header) : "", std::move(out)});
+    cache_.emplace(std::move(id), cache_list_.begin());
   }
 
   return true;
 }
 
-FilterHeadersStatus PluginContext::onRequestHeaders(uint32_t) {
+const PluginRootContext::ConnectionPeer* PluginRootContext::connectionPeer(
+    uint64_t connection_id) {
+  auto it = connection_peers_.find(connection_id);
+  if (it == connection_peers_.end()) {
+    return nullptr;
+  }
+  connection_peer_list_.splice(connection_peer_list_.begin(),
+                               connection_peer_list_, it->second);
+  return &it->second->second;
+}
+
+void PluginRootContext::setConnectionPeer(uint64_t connection_id,
+                                          ConnectionPeer&& peer) {
+  auto it = connection_peers_.find(connection_id);
+  if (it != connection_peers_.end()) {
+    it->second->second = std::move(peer);
+    connection_peer_list_.splice(connection_peer_list_.begin(),
+                                 connection_peer_list_, it->second);
+    return;
+  }
+  while (connection_peer_list_.size() >= MaxConnectionPeers) {
+    connection_peers_.erase(connection_peer_list_.back().first);
+    connection_peer_list_.pop_back();
+  }
+  connection_peer_list_.emplace_front(connection_id, std::move(peer));
+  connection_peers_.emplace(connection_id, connection_peer_list_.begin());
+}
+
+PluginRootContext::UpstreamExchange& PluginRootContext::upstreamExchange(
+    const std::string& authority) {
+  if (upstream_exchanges_.size() >= MaxUpstreamExchanges &&
+      upstream_exchanges_.find(authority) == upstream_exchanges_.end()) {
+    upstream_exchanges_.clear();
+  }
+  return upstream_exchanges_[authority];
+}
+
+std::string PluginRootContext::sharedPeerSlot(StringView peer_key) {
+  return absl::StrCat(SharedPeerCachePrefix,
+                      fnv1a(peer_key) % max_shared_peer_cache_size_);
+}
+
+// A shared cache slot holds the key of its peer, followed by a NUL and the
+// peer flat buffer. Peer IDs and hashes come from headers, which cannot
+// contain a NUL.
+bool PluginRootContext::getSharedPeer(StringView peer_key, std::string* out) {
+  WasmDataPtr value;
+  if (getSharedData(sharedPeerSlot(peer_key), &value) != WasmResult::Ok) {
+    return false;
+  }
+  const auto slot = value->view();
+  if (slot.size() <= peer_key.size() ||
+      slot.substr(0, peer_key.size()) != peer_key ||
+      slot[peer_key.size()] != '\0') {
+    return false;
+  }
+  out->assign(slot.data() + peer_key.size() + 1,
+              slot.size() - peer_key.size() - 1);
+  return true;
+}
+
+void PluginRootContext::setSharedPeer(StringView peer_key, StringView value) {
+  // the peer replaces the one held by its slot, if any.
+  std::string slot;
+  slot.reserve(peer_key.size() + 1 + value.size());
+  slot.append(peer_key.data(), peer_key.size());
+  slot.push_back('\0');
+  slot.append(value.data(), value.size());
+  setSharedData(sharedPeerSlot(peer_key), slot);
+}
+
+bool PluginContext::reuseConnectionPeer(uint64_t connection_id) {
+  const auto* peer = rootContext()->connectionPeer(connection_id);
+  if (peer == nullptr) {
+    return false;
+  }
+  removeRequestHeader(ExchangeMetadataHeaderId);
+  removeRequestHeader(ExchangeMetadataHeaderHash);
+  removeRequestHeader(ExchangeMetadataHeader);
+  setFilterState(::Wasm::Common::kDownstreamMetadataIdKey, peer->id);
+  setFilterState(::Wasm::Common::kDownstreamMetadataKey, peer->peer);
+  flat_metadata_received_ = peer->flat;
+  metadata_hash_received_ = peer->compact;
+  return true;
+}
+
+void PluginContext::updateDownstreamPeer(bool has_connection_id,
+                                         uint64_t connection_id) {
   // strip and store downstream peer metadata
   auto downstream_metadata_id = getRequestHeader(ExchangeMetadataHeaderId);
   if (downstream_metadata_id != nullptr &&
@@ -170,23 +347,91 @@ FilterHeadersStatus PluginContext::onRequestHeaders(uint32_t) {
     metadata_id_received_ = false;
   }
 
+  // compact metadata exchange header
+  auto downstream_metadata_hash = getRequestHeader(ExchangeMetadataHeaderHash);
+  StringView downstream_hash;
+  if (downstream_metadata_hash != nullptr &&
+      !downstream_metadata_hash->view().empty()) {
+    removeRequestHeader(ExchangeMetadataHeaderHash);
+    metadata_hash_received_ = true;
+    downstream_hash = downstream_metadata_hash->view();
+  }
+
+  std::string peer;
+  bool resolved = false;
   auto downstream_metadata_value = getRequestHeader(ExchangeMetadataHeader);
   if (downstream_metadata_value != nullptr &&
       !downstream_metadata_value->view().empty()) {
     removeRequestHeader(ExchangeMetadataHeader);
-    if (!rootContext()->updatePeer(::Wasm::Common::kDownstreamMetadataKey,
-                                   downstream_metadata_id->view(),
-                                   downstream_metadata_value->view())) {
+    flat_metadata_received_ = absl::StartsWith(
+        downstream_metadata_value->view(), FlatMetadataPrefix);
+    resolved = rootContext()->updatePeer(
+        ::Wasm::Common::kDownstreamMetadataKey, downstream_metadata_id->view(),
+        downstream_hash, downstream_metadata_value->view(), &peer);
+    if (!resolved) {
       logDebug("cannot set downstream peer node");
     }
+  } else if (metadata_hash_received_ && metadata_id_received_) {
+    // the downstream peer only sent its ID and hash, ask for the full
+    // metadata in the response if it is not cached.
+    resolved = rootContext()->updatePeer(
+        ::Wasm::Common::kDownstreamMetadataKey, downstream_metadata_id->view(),
+        downstream_hash, {}, &peer);
+    downstream_peer_unknown_ = !resolved;
   } else {
     metadata_received_ = false;
   }
 
+  if (resolved && has_connection_id && metadata_id_received_) {
+    rootContext()->setConnectionPeer(
+        connection_id,
+        {downstream_metadata_id->toString(), std::move(peer),
+         flat_metadata_received_, metadata_hash_received_});
+  }
+}
+
+FilterHeadersStatus PluginContext::onRequestHeaders(uint32_t) {
+  auto downstream_metadata_request =
+      getRequestHeader(ExchangeMetadataHeaderRequest);
+  if (downstream_metadata_request != nullptr &&
+      !downstream_metadata_request->view().empty()) {
+    removeRequestHeader(ExchangeMetadataHeaderRequest);
+    full_metadata_requested_ = true;
+  }
+
+  // the peer of a downstream connection does not change, so its metadata is
+  // only read on the first stream of the connection. The downstream of an
+  // outbound proxy is the local application, which sends no metadata.
+  uint64_t connection_id = 0;
+  const bool has_connection_id =
+      direction_ != ::Wasm::Common::TrafficDirection::Outbound &&
+      getValue({"connection", "id"}, &connection_id);
+  if (!has_connection_id || !reuseConnectionPeer(connection_id)) {
+    updateDownstreamPeer(has_connection_id, connection_id);
+  }
+
   // do not send request internal headers to sidecar app if it is an inbound
   // proxy
   if (direction_ != ::Wasm::Common::TrafficDirection::Inbound) {
-    auto metadata = metadataValue();
+    auto metadata = rootContext()->sendFlatMetadata() ? flatMetadataValue()
+                                                      : metadataValue();
+    if (rootContext()->compactMetadata()) {
+      auto authority = getRequestHeader(::Wasm::Common::kAuthorityHeaderKey);
+      if (authority != nullptr) {
+        upstream_authority_ = authority->toString();
+      }
+      auto& upstream = rootContext()->upstreamExchange(upstream_authority_);
+      replaceRequestHeader(ExchangeMetadataHeaderHash,
+                           rootContext()->metadataHash());
+      if (std::exchange(upstream.request_full_metadata, false)) {
+        replaceRequestHeader(ExchangeMetadataHeaderRequest, "1");
+      }
+      // only send the full metadata on first contact or when the upstream
+      // peer asked for it.
+      if (!std::exchange(upstream.send_full_metadata, false)) {
+        metadata = {};
+      }
+    }
     // insert peer metadata struct for upstream
     if (!metadata.empty()) {
       replaceRequestHeader(ExchangeMetadataHeader, metadata);
@@ -211,21 +456,66 @@ FilterHeadersStatus PluginContext::onResponseHeaders(uint32_t) {
                    upstream_metadata_id->view());
   }
 
+  // compact metadata exchange headers
+  auto upstream_metadata_hash = getResponseHeader(ExchangeMetadataHeaderHash);
+  StringView upstream_hash;
+  if (upstream_metadata_hash != nullptr &&
+      !upstream_metadata_hash->view().empty()) {
+    removeResponseHeader(ExchangeMetadataHeaderHash);
+    upstream_hash = upstream_metadata_hash->view();
+  }
+  auto upstream_metadata_request =
+      getResponseHeader(ExchangeMetadataHeaderRequest);
+  if (upstream_metadata_request != nullptr &&
+      !upstream_metadata_request->view().empty()) {
+    removeResponseHeader(ExchangeMetadataHeaderRequest);
+    if (rootContext()->compactMetadata()) {
+      rootContext()->upstreamExchange(upstream_authority_).send_full_metadata =
+          true;
+    }
+  }
+
   auto upstream_metadata_value = getResponseHeader(ExchangeMetadataHeader);
   if (upstream_metadata_value != nullptr &&
       !upstream_metadata_value->view().empty()) {
     removeResponseHeader(ExchangeMetadataHeader);
     if (!rootContext()->updatePeer(::Wasm::Common::kUpstreamMetadataKey,
-                                   upstream_metadata_id->view(),
+                                   upstream_metadata_id->view(), upstream_hash,
                                    upstream_metadata_value->view())) {
       logDebug("cannot set upstream peer node");
     }
+  } else if (!upstream_hash.empty() && upstream_metadata_id != nullptr &&
+             !upstream_metadata_id->view().empty()) {
+    // the upstream peer only sent its ID and hash, ask for the full metadata
+    // on the next request if it is not cached.
+    if (!rootContext()->updatePeer(::Wasm::Common::kUpstreamMetadataKey,
+                                   upstream_metadata_id->view(), upstream_hash,
+                                   {}) &&
+        rootContext()->compactMetadata()) {
+      rootContext()
+          ->upstreamExchange(upstream_authority_)
+          .request_full_metadata = true;
+    }
   }
 
   // do not send response internal headers to sidecar app if it is an outbound
   // proxy
   if (direction_ != ::Wasm::Common::TrafficDirection::Outbound) {
-    auto metadata = metadataValue();
+    // reply in the format of the downstream peer.
+    auto metadata =
+        flat_metadata_received_ ? flatMetadataValue() : metadataValue();
+    if (metadata_hash_received_ && metadata_received_ &&
+        !rootContext()->metadataHash().empty()) {
+      replaceResponseHeader(ExchangeMetadataHeaderHash,
+                            rootContext()->metadataHash());
+      if (downstream_peer_unknown_) {
+        replaceResponseHeader(ExchangeMetadataHeaderRequest, "1");
+      }
+      // only send the full metadata when the downstream peer asked for it.
+      if (!full_metadata_requested_) {
+        metadata = {};
+      }
+    }
     // insert peer metadata struct for downstream
     if (!metadata.empty() && metadata_received_) {
       replaceResponseHeader(ExchangeMetadataHeader, metadata);
@@ -15,6 +15,9 @@
 
 #pragma once
 
+#include <list>
+#include <utility>
+
 #include "extensions/common/context.h"
 
 #ifndef NULL_PLUGIN
@@ -47,7 +50,22 @@ using NullPluginRegistry =
 
 constexpr StringView ExchangeMetadataHeader = "x-envoy-peer-metadata";
 constexpr StringView ExchangeMetadataHeaderId = "x-envoy-peer-metadata-id";
+// Hash of the peer metadata, sent along with or instead of the metadata.
+constexpr StringView ExchangeMetadataHeaderHash = "x-envoy-peer-metadata-hash";
+// Sent by a peer that could not resolve the peer metadata from its ID and
+// hash, to ask for the full metadata.
+constexpr StringView ExchangeMetadataHeaderRequest =
+    "x-envoy-peer-metadata-request";
+// Prefix of the peer metadata header values that carry a base64 encoded
+// FlatNode instead of a base64 encoded struct. '.' is not a base64 character.
+constexpr StringView FlatMetadataPrefix = "fb1.";
 const size_t DefaultNodeCacheMaxSize = 500;
+const size_t MaxConnectionPeers = 1000;
+const size_t MaxUpstreamExchanges = 1000;
+// Prefix of the shared data keys of the peer cache slots shared by the
+// workers. The version changes along with the format of the cached peers.
+constexpr StringView SharedPeerCachePrefix =
+    "envoy.wasm.metadata_exchange.peer.v2/";
 
 // PluginRootContext is the root context for all streams processed by the
 // thread. It has the same lifetime as the worker thread and acts as target for
@@ -55,7 +73,14 @@ const size_t DefaultNodeCacheMaxSize = 500;
 class PluginRootContext : public RootContext {
  public:
   PluginRootContext(uint32_t id, StringView root_id)
-      : RootContext(id, root_id) {}
+      : RootContext(id, root_id) {
+    Metric cache_count(MetricType::Counter, "metric_cache_count",
+                       {MetricTag{"wasm_filter", MetricTag::TagType::String},
+                        MetricTag{"cache", MetricTag::TagType::String}});
+    cache_hits_ = cache_count.resolve("metadata_exchange", "hit");
+    cache_misses_ = cache_count.resolve("metadata_exchange", "miss");
+    cache_evictions_ = cache_count.resolve("metadata_exchange", "eviction");
+  }
   ~PluginRootContext() = default;
 
   bool onConfigure(size_t) override;
@@ -63,17 +88,86 @@ class PluginRootContext : public RootContext {
   void onTick() override{};
 
   StringView metadataValue() { return metadata_value_; };
+  StringView flatMetadataValue() { return flat_metadata_value_; };
+  bool sendFlatMetadata() { return send_flat_metadata_; };
+  StringView metadataHash() { return metadata_hash_; };
   StringView nodeId() { return node_id_; };
-  bool updatePeer(StringView key, StringView peer_id, StringView peer_header);
+  // Stores the peer metadata in the filter state. Cached peers are identified
+  // by their ID and the hash sent by the peer, or else the peer header.
+  // Without the peer header, the peer is only resolved from the cache by ID
+  // and hash.
+  bool updatePeer(StringView key, StringView peer_id, StringView peer_hash,
+                  StringView peer_header, std::string* peer = nullptr);
+
+  // Peer of a downstream connection, which does not change for the streams
+  // of the connection.
+  struct ConnectionPeer {
+    std::string id;
+    std::string peer;
+    bool flat;
+    bool compact;
+  };
+  const ConnectionPeer* connectionPeer(uint64_t connection_id);
+  void setConnectionPeer(uint64_t connection_id, ConnectionPeer&& peer);
+
+  // In the compact metadata exchange, the full metadata is sent and asked for
+  // on the first request to an upstream, told apart by the request authority.
+  // After that, it is only sent when the upstream peer asks for it, and only
+  // asked for on the next request once the upstream peer is missing from the
+  // cache.
+  struct UpstreamExchange {
+    bool send_full_metadata{true};
+    bool request_full_metadata{true};
+  };
+  bool compactMetadata() { return compact_metadata_; };
+  UpstreamExchange& upstreamExchange(const std::string& authority);
 
  private:
   void updateMetadataValue();
+  bool getSharedPeer(StringView peer_key, std::string* out);
+  void setSharedPeer(StringView peer_key, StringView value);
+  std::string sharedPeerSlot(StringView peer_key);
   std::string metadata_value_;
+  std::string flat_metadata_value_;
+  std::string metadata_hash_;
+  bool send_flat_metadata_{false};
+  bool compact_metadata_{false};
   std::string node_id_;
 
-  // maps peer ID to the decoded peer flat buffer
-  std::unordered_map<std::string, std::string> cache_;
+  struct PeerCacheEntry {
+    std::string id;
+    // hash of the peer metadata sent by the peer, if any.
+    std::string hash;
+    // peer header the peer was decoded from, when it sent no hash.
+    std::string header;
+    std::string peer;
+  };
+  // decoded peer flat buffers, most recently used first.
+  using PeerCacheList = std::list<PeerCacheEntry>;
+  PeerCacheList cache_list_;
+  // maps peer ID to its entry in the cache list.
+  std::unordered_map<std::string, PeerCacheList::iterator> cache_;
   uint32_t max_peer_cache_size_{DefaultNodeCacheMaxSize};
+  uint32_t max_shared_peer_cache_size_{0};
+
+  // peers of the downstream connections, most recently used first.
+  // Connections are not notified to the HTTP plugin when they close, so the
+  // least recently used ones are evicted once the list is full.
+  using ConnectionPeerList = std::list<std::pair<uint64_t, ConnectionPeer>>;
+  ConnectionPeerList connection_peer_list_;
+  // maps downstream connection ID to its entry in the connection peer list.
+  std::unordered_map<uint64_t, ConnectionPeerList::iterator> connection_peers_;
+
+  // maps upstream authority to its compact metadata exchange state. The map
+  // is cleared once full, so the full metadata is sent again to the
+  // upstreams that were forgotten.
+  std::unordered_map<std::string, UpstreamExchange> upstream_exchanges_;
+
+  // Cache hits are frequent, so they are counted in batches.
+  int64_t cache_hits_accumulator_ = 0;
+  uint32_t cache_hits_;
+  uint32_t cache_misses_;
+  uint32_t cache_evictions_;
 };
 
 class PluginRootContextOutbound : public PluginRootContext {
@@ -100,15 +194,28 @@ class PluginContext : public Context {
   FilterHeadersStatus onResponseHeaders(uint32_t) override;
 
  private:
+  bool reuseConnectionPeer(uint64_t connection_id);
+  void updateDownstreamPeer(bool has_connection_id, uint64_t connection_id);
+
   inline PluginRootContext* rootContext() {
     return dynamic_cast<PluginRootContext*>(this->root());
   };
   inline StringView metadataValue() { return rootContext()->metadataValue(); };
+  inline StringView flatMetadataValue() {
+    return rootContext()->flatMetadataValue();
+  };
   inline StringView nodeId() { return rootContext()->nodeId(); }
 
   ::Wasm::Common::TrafficDirection direction_;
   bool metadata_received_{true};
   bool metadata_id_received_{true};
+  bool flat_metadata_received_{false};
+  // compact metadata exchange state of the downstream peer.
+  bool metadata_hash_received_{false};
+  bool full_metadata_requested_{false};
+  bool downstream_peer_unknown_{false};
+  // authority of the upstream request in the compact metadata exchange.
+  std::string upstream_authority_;
 };
 
 #ifdef NULL_PLUGIN
@@ -47,6 +47,23 @@ uint32_t newExportCallMetric(const std::string& type, bool success) {
   return export_call.resolve("stackdriver_filter", type, success);
 }
 
+uint32_t newExportDroppedMetric(const std::string& type) {
+  // See newExportCallMetric for why the metric is not a global object.
+  Metric export_dropped(MetricType::Counter, "export_dropped_entries",
+                        {MetricTag{"wasm_filter", MetricTag::TagType::String},
+                         MetricTag{"type", MetricTag::TagType::String}});
+  return export_dropped.resolve("stackdriver_filter", type);
+}
+
+uint32_t newExportQueueDepthMetric(const std::string& type) {
+  // See newExportCallMetric for why the metric is not a global object.
+  Metric export_queue_depth(
+      MetricType::Gauge, "export_queue_depth",
+      {MetricTag{"wasm_filter", MetricTag::TagType::String},
+       MetricTag{"type", MetricTag::TagType::String}});
+  return export_queue_depth.resolve("stackdriver_filter", type);
+}
+
 }  // namespace Common
 }  // namespace Stackdriver
 }  // namespace Extensions
@@ -38,6 +38,14 @@ namespace Common {
 // could only be logging or edge.
 uint32_t newExportCallMetric(const std::string& type, bool success);
 
+// newExportDroppedMetric creates a counter of the entries dropped from the
+// export queue of the given type.
+uint32_t newExportDroppedMetric(const std::string& type);
+
+// newExportQueueDepthMetric creates a gauge of the requests waiting in the
+// export queue of the given type.
+uint32_t newExportQueueDepthMetric(const std::string& type);
+
 }  // namespace Common
 }  // namespace Stackdriver
 }  // namespace Extensions
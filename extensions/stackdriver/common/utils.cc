@@ -15,6 +15,8 @@
 
 #include "extensions/stackdriver/common/utils.h"
 
+#include <algorithm>
+
 #include "extensions/stackdriver/common/constants.h"
 #include "grpcpp/grpcpp.h"
 
@@ -168,6 +170,18 @@ void setSTSCallCredentialOptions(
   sts_options->scope = kSTSScope;
 }
 
+int getTickPeriodMilliseconds(int metric_export_interval_milliseconds,
+                              int log_export_milliseconds,
+                              int flushes_per_interval) {
+  int tick_milliseconds = std::max(
+      1, std::min(log_export_milliseconds,
+                  metric_export_interval_milliseconds / flushes_per_interval));
+  while (log_export_milliseconds % tick_milliseconds != 0) {
+    tick_milliseconds--;
+  }
+  return tick_milliseconds;
+}
+
 }  // namespace Common
 }  // namespace Stackdriver
 }  // namespace Extensions
@@ -58,6 +58,14 @@ void setSTSCallCredentialOptions(
     ::grpc::experimental::StsCredentialsOptions *sts_options,
     const std::string &sts_port, const std::string &token_path);
 
+// Gets the tick period that flushes pre-aggregated metrics at least
+// flushes_per_interval times per metric export interval, and divides the log
+// export period evenly so that logs are exported on a tick exactly at that
+// period.
+int getTickPeriodMilliseconds(int metric_export_interval_milliseconds,
+                              int log_export_milliseconds,
+                              int flushes_per_interval);
+
 }  // namespace Common
 }  // namespace Stackdriver
 }  // namespace Extensions
@@ -0,0 +1,65 @@
+/* Copyright 2020 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "extensions/stackdriver/common/utils.h"
+
+#include "gtest/gtest.h"
+
+namespace Extensions {
+namespace Stackdriver {
+namespace Common {
+
+namespace {
+
+constexpr int kLogExportMilliseconds = 10000;
+constexpr int kFlushesPerInterval = 10;
+
+// Returns the milliseconds between log exports made every few ticks.
+int logExportPeriod(int metric_export_interval_milliseconds) {
+  const int tick = getTickPeriodMilliseconds(
+      metric_export_interval_milliseconds, kLogExportMilliseconds,
+      kFlushesPerInterval);
+  return kLogExportMilliseconds / tick * tick;
+}
+
+}  // namespace
+
+TEST(UtilsTest, TickPeriodAtDefaultInterval) {
+  // The default 60s metric export interval is flushed every 5s, and logs are
+  // exported every other tick.
+  EXPECT_EQ(5000, getTickPeriodMilliseconds(60000, kLogExportMilliseconds,
+                                            kFlushesPerInterval));
+  EXPECT_EQ(kLogExportMilliseconds, logExportPeriod(60000));
+}
+
+TEST(UtilsTest, TickPeriodDividesLogExportPeriod) {
+  for (int interval = 1000; interval <= 300000; interval += 500) {
+    const int tick = getTickPeriodMilliseconds(
+        interval, kLogExportMilliseconds, kFlushesPerInterval);
+    EXPECT_LE(tick, interval / kFlushesPerInterval) << interval;
+    EXPECT_EQ(kLogExportMilliseconds, logExportPeriod(interval)) << interval;
+  }
+  EXPECT_EQ(1250, getTickPeriodMilliseconds(15000, kLogExportMilliseconds,
+                                            kFlushesPerInterval));
+  EXPECT_EQ(kLogExportMilliseconds,
+            getTickPeriodMilliseconds(600000, kLogExportMilliseconds,
+                                      kFlushesPerInterval));
+  EXPECT_EQ(1, getTickPeriodMilliseconds(0, kLogExportMilliseconds,
+                                         kFlushesPerInterval));
+}
+
+}  // namespace Common
+}  // namespace Stackdriver
+}  // namespace Extensions
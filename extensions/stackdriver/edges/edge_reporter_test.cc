@@ -145,9 +145,9 @@ const ::Wasm::Common::FlatNode& nodeInfo(flatbuffers::FlatBufferBuilder& fbb,
 
 ::Wasm::Common::RequestInfo requestInfo() {
   ::Wasm::Common::RequestInfo request_info;
-  request_info.destination_service_host = "httpbin.org";
-  request_info.destination_service_name = "httpbin";
-  request_info.request_protocol = "HTTP";
+  request_info.set_destination_service_host("httpbin.org");
+  request_info.set_destination_service_name("httpbin");
+  request_info.set_request_protocol("HTTP");
   return request_info;
 }
 
@@ -42,39 +42,123 @@ namespace Extensions {
 namespace Stackdriver {
 namespace Log {
 
-ExporterImpl::ExporterImpl(
-    RootContext* root_context,
-    const ::Extensions::Stackdriver::Common::StackdriverStubOption&
-        stub_option) {
-  context_ = root_context;
-  auto success_counter = Common::newExportCallMetric("logging", true);
-  auto failure_counter = Common::newExportCallMetric("logging", false);
-  success_callback_ = [this, success_counter](size_t) {
-    incrementMetric(success_counter, 1);
-    LOG_DEBUG("successfully sent Stackdriver logging request");
+ExportQueue::ExportQueue(ExportClient* client,
+                         const ExportQueueOption& option)
+    : client_(client), option_(option) {}
+
+void ExportQueue::exportRequests(
+    const std::vector<const google::logging::v2::WriteLogEntriesRequest*>&
+        requests,
+    bool is_on_done) {
+  is_on_done_ = is_on_done;
+  // Requests left queued because calls could not be made are retried first.
+  exportQueued();
+  for (const auto& req : requests) {
+    // Requests are exported in order, so they are queued behind the queued
+    // ones.
+    if (!queue_.empty() || in_flight_export_call_ >= option_.max_export_calls ||
+        !exportRequest(*req)) {
+      enqueue(*req);
+    }
+  }
+  client_->recordQueueDepth(queue_.size());
+}
+
+bool ExportQueue::exportRequest(
+    const google::logging::v2::WriteLogEntriesRequest& req) {
+  const bool ok = client_->exportRequest(req, [this](bool) {
     in_flight_export_call_ -= 1;
     if (in_flight_export_call_ < 0) {
       LOG_WARN("in flight report call should not be negative");
     }
-    if (in_flight_export_call_ <= 0 && is_on_done_) {
-      proxy_done();
+    exportQueued();
+    maybeDone();
+  });
+  if (!ok) {
+    return false;
+  }
+  in_flight_export_call_ += 1;
+  return true;
+}
+
+void ExportQueue::enqueue(
+    const google::logging::v2::WriteLogEntriesRequest& req) {
+  const int64_t size = req.ByteSizeLong();
+  if (size > option_.max_queue_bytes) {
+    client_->recordDroppedEntries(req.entries_size());
+    return;
+  }
+  while (queued_bytes_ + size > option_.max_queue_bytes) {
+    switch (option_.overflow_policy) {
+      case ::stackdriver::config::v1alpha1::PluginConfig::DROP_NEWEST:
+        client_->recordDroppedEntries(req.entries_size());
+        return;
+      case ::stackdriver::config::v1alpha1::PluginConfig::SAMPLE: {
+        // The new request is one of the candidates, so that all requests are
+        // equally likely to be kept.
+        const size_t index = random_() % (queue_.size() + 1);
+        if (index == queue_.size()) {
+          client_->recordDroppedEntries(req.entries_size());
+          return;
+        }
+        dropQueued(queue_.begin() + index);
+        break;
+      }
+      default:
+        dropQueued(queue_.begin());
+        break;
     }
-  };
+  }
+  // The request is serialized, since the logger reuses its memory once
+  // exportRequests returns. This keeps it in a single allocation.
+  queue_.push_back(QueuedRequest{req.SerializeAsString(), req.entries_size()});
+  queued_bytes_ += size;
+}
 
-  failure_callback_ = [this, failure_counter](GrpcStatus status) {
-    // TODO(bianpengyuan): add retry.
-    incrementMetric(failure_counter, 1);
-    logWarn("Stackdriver logging api call error: " +
-            std::to_string(static_cast<int>(status)) +
-            getStatus().second->toString());
-    in_flight_export_call_ -= 1;
-    if (in_flight_export_call_ < 0) {
-      LOG_WARN("in flight report call should not be negative");
+void ExportQueue::dropQueued(std::deque<QueuedRequest>::iterator iter) {
+  client_->recordDroppedEntries(iter->entries);
+  queued_bytes_ -= iter->serialized.size();
+  queue_.erase(iter);
+}
+
+void ExportQueue::exportQueued() {
+  if (queue_.empty()) {
+    return;
+  }
+  google::logging::v2::WriteLogEntriesRequest req;
+  while (!queue_.empty() && in_flight_export_call_ < option_.max_export_calls) {
+    // Queued requests are parsed back for the call, which is only paid for
+    // by the requests that could not be exported right away.
+    if (!req.ParseFromString(queue_.front().serialized)) {
+      dropQueued(queue_.begin());
+      continue;
     }
-    if (in_flight_export_call_ <= 0 && is_on_done_) {
-      proxy_done();
+    if (!exportRequest(req)) {
+      break;
     }
-  };
+    queued_bytes_ -= queue_.front().serialized.size();
+    queue_.pop_front();
+  }
+  client_->recordQueueDepth(queue_.size());
+}
+
+void ExportQueue::maybeDone() {
+  if (in_flight_export_call_ <= 0 && is_on_done_) {
+    client_->done();
+  }
+}
+
+ExporterImpl::ExporterImpl(
+    RootContext* root_context,
+    const ::Extensions::Stackdriver::Common::StackdriverStubOption&
+        stub_option,
+    const ExportQueueOption& queue_option)
+    : queue_(this, queue_option) {
+  context_ = root_context;
+  success_counter_ = Common::newExportCallMetric("logging", true);
+  failure_counter_ = Common::newExportCallMetric("logging", false);
+  dropped_entries_metric_ = Common::newExportDroppedMetric("logging");
+  queue_depth_metric_ = Common::newExportQueueDepthMetric("logging");
 
   // Construct grpc_service for the Stackdriver gRPC call.
   GrpcService grpc_service;
@@ -84,23 +168,48 @@ ExporterImpl::ExporterImpl(
 }
 
 void ExporterImpl::exportLogs(
-    const std::vector<std::unique_ptr<
-        const google::logging::v2::WriteLogEntriesRequest>>& requests,
+    const std::vector<const google::logging::v2::WriteLogEntriesRequest*>&
+        requests,
     bool is_on_done) {
-  is_on_done_ = is_on_done;
-  for (const auto& req : requests) {
-    auto result = context_->grpcSimpleCall(
-        grpc_service_string_, kGoogleLoggingService,
-        kGoogleWriteLogEntriesMethod, *req, kDefaultTimeoutMillisecond,
-        success_callback_, failure_callback_);
-    if (result != WasmResult::Ok) {
-      LOG_WARN("failed to make stackdriver logging export call");
-      break;
-    }
-    in_flight_export_call_ += 1;
+  queue_.exportRequests(requests, is_on_done);
+}
+
+bool ExporterImpl::exportRequest(
+    const google::logging::v2::WriteLogEntriesRequest& req,
+    std::function<void(bool success)> on_done) {
+  auto success_callback = [this, on_done](size_t) {
+    incrementMetric(success_counter_, 1);
+    LOG_DEBUG("successfully sent Stackdriver logging request");
+    on_done(true);
+  };
+  auto failure_callback = [this, on_done](GrpcStatus status) {
+    // TODO(bianpengyuan): add retry.
+    incrementMetric(failure_counter_, 1);
+    logWarn("Stackdriver logging api call error: " +
+            std::to_string(static_cast<int>(status)) +
+            getStatus().second->toString());
+    on_done(false);
+  };
+  auto result = context_->grpcSimpleCall(
+      grpc_service_string_, kGoogleLoggingService, kGoogleWriteLogEntriesMethod,
+      req, kDefaultTimeoutMillisecond, success_callback, failure_callback);
+  if (result != WasmResult::Ok) {
+    LOG_WARN("failed to make stackdriver logging export call");
+    return false;
   }
+  return true;
+}
+
+void ExporterImpl::recordDroppedEntries(int64_t entries) {
+  incrementMetric(dropped_entries_metric_, entries);
 }
 
+void ExporterImpl::recordQueueDepth(size_t depth) {
+  recordMetric(queue_depth_metric_, depth);
+}
+
+void ExporterImpl::done() { proxy_done(); }
+
 }  // namespace Log
 }  // namespace Stackdriver
 }  // namespace Extensions
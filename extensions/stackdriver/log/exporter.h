@@ -15,9 +15,13 @@
 
 #pragma once
 
+#include <deque>
+#include <functional>
+#include <random>
 #include <string>
 
 #include "extensions/stackdriver/common/utils.h"
+#include "extensions/stackdriver/config/v1alpha1/stackdriver_plugin_config.pb.h"
 #include "google/logging/v2/logging.pb.h"
 
 #ifndef NULL_PLUGIN
@@ -44,26 +48,137 @@ class Exporter {
   virtual ~Exporter() {}
 
   virtual void exportLogs(
-      const std::vector<
-          std::unique_ptr<const google::logging::v2::WriteLogEntriesRequest>>&,
+      const std::vector<const google::logging::v2::WriteLogEntriesRequest*>&,
       bool is_on_done) = 0;
 };
 
+using OverflowPolicy =
+    ::stackdriver::config::v1alpha1::PluginConfig::LogExportOverflowPolicy;
+
+// Bounds of the export queue, which holds the requests that are not exported
+// yet because too many export calls are in flight.
+struct ExportQueueOption {
+  // Maximum number of export calls in flight.
+  int max_export_calls = 10;
+  // Maximum total serialized size of the queued requests.
+  int64_t max_queue_bytes = 32000000;
+  // Requests dropped when the queue is full.
+  OverflowPolicy overflow_policy =
+      ::stackdriver::config::v1alpha1::PluginConfig::DROP_OLDEST;
+};
+
+// ExportClient makes the export calls of an ExportQueue and records its
+// metrics. It is implemented with the Wasm runtime by ExporterImpl, and faked
+// in tests.
+class ExportClient {
+ public:
+  virtual ~ExportClient() {}
+
+  // Makes an export call of the request, which is copied before it returns.
+  // on_done is called with whether the call succeeded once it finishes.
+  // Returns false if the call cannot be made.
+  virtual bool exportRequest(
+      const google::logging::v2::WriteLogEntriesRequest& req,
+      std::function<void(bool success)> on_done) = 0;
+
+  // Records the number of log entries dropped from the queue.
+  virtual void recordDroppedEntries(int64_t entries) = 0;
+
+  // Records the number of requests waiting in the queue.
+  virtual void recordQueueDepth(size_t depth) = 0;
+
+  // Signals that the export started on done has finished.
+  virtual void done() = 0;
+};
+
+// ExportQueue exports requests with at most max_export_calls calls in flight.
+// The other requests wait in the queue, serialized, and are exported in order
+// as calls finish, or on the next export if a call cannot be made.
+class ExportQueue {
+ public:
+  ExportQueue(ExportClient* client, const ExportQueueOption& option);
+
+  // Exports the given requests, or queues them. The requests are serialized
+  // when queued, so they are not used after this returns. If is_on_done is
+  // true, the client is told once no call is left in flight.
+  void exportRequests(
+      const std::vector<const google::logging::v2::WriteLogEntriesRequest*>&
+          requests,
+      bool is_on_done);
+
+  // Number of requests waiting in the queue, and their total size.
+  size_t size() const { return queue_.size(); }
+  int64_t bytes() const { return queued_bytes_; }
+
+ private:
+  // Request waiting to be exported.
+  struct QueuedRequest {
+    std::string serialized;
+    int entries;
+  };
+
+  // Makes an export call of the given request. Returns false if the call
+  // cannot be made.
+  bool exportRequest(const google::logging::v2::WriteLogEntriesRequest& req);
+
+  // Adds a request to the queue, dropping requests as the overflow policy
+  // says if the queue is full.
+  void enqueue(const google::logging::v2::WriteLogEntriesRequest& req);
+
+  // Exports queued requests while fewer than the maximum export calls are in
+  // flight.
+  void exportQueued();
+
+  // Drops a queued request.
+  void dropQueued(std::deque<QueuedRequest>::iterator iter);
+
+  // Tells the client if the export on done has finished.
+  void maybeDone();
+
+  ExportClient* client_;
+
+  ExportQueueOption option_;
+
+  // Indicates if the current exporting is triggered by root context onDone.
+  bool is_on_done_ = false;
+
+  // Record in flight export calls. When ondone is triggered, export call needs
+  // to be zero before calling proxy_done.
+  int in_flight_export_call_ = 0;
+
+  // Requests waiting to be exported, oldest first.
+  std::deque<QueuedRequest> queue_;
+
+  // Total serialized size of the queued requests.
+  int64_t queued_bytes_ = 0;
+
+  // Picks the requests dropped by the SAMPLE overflow policy.
+  std::minstd_rand random_;
+};
+
 // Exporter writes Stackdriver access log to the backend. It uses WebAssembly
 // gRPC API.
-class ExporterImpl : public Exporter {
+class ExporterImpl : public Exporter, public ExportClient {
  public:
   // root_context is the wasm runtime context that this instance runs with.
   // logging_service_endpoint is an optional param which should be used for test
   // only.
   ExporterImpl(RootContext* root_context,
                const ::Extensions::Stackdriver::Common::StackdriverStubOption&
-                   stub_option);
+                   stub_option,
+               const ExportQueueOption& queue_option = ExportQueueOption());
 
   // exportLogs exports the given log request to Stackdriver.
-  void exportLogs(const std::vector<std::unique_ptr<
-                      const google::logging::v2::WriteLogEntriesRequest>>& req,
-                  bool is_on_done) override;
+  void exportLogs(
+      const std::vector<const google::logging::v2::WriteLogEntriesRequest*>&
+          req,
+      bool is_on_done) override;
+
+  bool exportRequest(const google::logging::v2::WriteLogEntriesRequest& req,
+                     std::function<void(bool success)> on_done) override;
+  void recordDroppedEntries(int64_t entries) override;
+  void recordQueueDepth(size_t depth) override;
+  void done() override;
 
  private:
   // Wasm context that outbound calls are attached to.
@@ -72,18 +187,12 @@ class ExporterImpl : public Exporter {
   // Serialized string of Stackdriver logging service
   std::string grpc_service_string_;
 
-  // Indicates if the current exporting is triggered by root context onDone. If
-  // this is true, gRPC callback needs to call proxy_done to indicate that async
-  // call finishes.
-  bool is_on_done_ = false;
+  uint32_t success_counter_;
+  uint32_t failure_counter_;
+  uint32_t dropped_entries_metric_;
+  uint32_t queue_depth_metric_;
 
-  // Callbacks for gRPC calls.
-  std::function<void(size_t)> success_callback_;
-  std::function<void(GrpcStatus)> failure_callback_;
-
-  // Record in flight export calls. When ondone is triggered, export call needs
-  // to be zero before calling proxy_done.
-  int in_flight_export_call_ = 0;
+  ExportQueue queue_;
 };
 
 }  // namespace Log
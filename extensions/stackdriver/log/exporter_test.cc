@@ -0,0 +1,260 @@
+/* Copyright 2020 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "extensions/stackdriver/log/exporter.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#ifdef NULL_PLUGIN
+namespace Envoy {
+namespace Extensions {
+namespace Common {
+namespace Wasm {
+namespace Null {
+namespace Plugin {
+#endif
+
+namespace Extensions {
+namespace Stackdriver {
+namespace Log {
+namespace {
+
+using google::logging::v2::WriteLogEntriesRequest;
+using ::stackdriver::config::v1alpha1::PluginConfig;
+
+// Export client that keeps the calls in flight until they are finished by
+// the test.
+class FakeExportClient : public ExportClient {
+ public:
+  bool exportRequest(const WriteLogEntriesRequest& req,
+                     std::function<void(bool success)> on_done) override {
+    if (!accept_calls) {
+      return false;
+    }
+    exported.push_back(req.log_name());
+    calls.push_back(std::move(on_done));
+    return true;
+  }
+
+  void recordDroppedEntries(int64_t entries) override {
+    dropped_entries += entries;
+  }
+
+  void recordQueueDepth(size_t depth) override { queue_depth = depth; }
+
+  void done() override { done_calls++; }
+
+  // Finishes the oldest call in flight.
+  void finishCall(bool success = true) {
+    ASSERT_FALSE(calls.empty());
+    auto on_done = std::move(calls.front());
+    calls.pop_front();
+    on_done(success);
+  }
+
+  bool accept_calls = true;
+  // Log names of the exported requests, in the order of their calls.
+  std::vector<std::string> exported;
+  std::deque<std::function<void(bool success)>> calls;
+  int64_t dropped_entries = 0;
+  size_t queue_depth = 0;
+  int done_calls = 0;
+};
+
+// Builds requests named by their index, with two entries each. Requests with
+// names of the same length have the same size.
+std::vector<WriteLogEntriesRequest> makeRequests(int count) {
+  std::vector<WriteLogEntriesRequest> requests(count);
+  for (int i = 0; i < count; i++) {
+    requests[i].set_log_name(std::to_string(i));
+    for (int j = 0; j < 2; j++) {
+      (*requests[i].add_entries()->mutable_labels())["request_id"] =
+          std::to_string(j);
+    }
+  }
+  return requests;
+}
+
+std::vector<const WriteLogEntriesRequest*> pointers(
+    const std::vector<WriteLogEntriesRequest>& requests) {
+  std::vector<const WriteLogEntriesRequest*> pointers;
+  for (const auto& req : requests) {
+    pointers.push_back(&req);
+  }
+  return pointers;
+}
+
+ExportQueueOption queueOption(int max_export_calls, int64_t max_queue_bytes,
+                              PluginConfig::LogExportOverflowPolicy policy) {
+  ExportQueueOption option;
+  option.max_export_calls = max_export_calls;
+  option.max_queue_bytes = max_queue_bytes;
+  option.overflow_policy = policy;
+  return option;
+}
+
+// Test that requests beyond the calls in flight are queued, and exported in
+// order as calls finish, whether they succeed or not.
+TEST(ExportQueueTest, InFlightCap) {
+  FakeExportClient client;
+  ExportQueue queue(&client,
+                    queueOption(2, 1000000, PluginConfig::DROP_OLDEST));
+  const auto requests = makeRequests(5);
+  queue.exportRequests(pointers(requests), /* is_on_done= */ false);
+  EXPECT_EQ(client.exported, std::vector<std::string>({"0", "1"}));
+  EXPECT_EQ(queue.size(), 3u);
+  EXPECT_EQ(client.queue_depth, 3u);
+  EXPECT_EQ(queue.bytes(), static_cast<int64_t>(requests[2].ByteSizeLong() +
+                                                requests[3].ByteSizeLong() +
+                                                requests[4].ByteSizeLong()));
+
+  client.finishCall();
+  EXPECT_EQ(client.exported, std::vector<std::string>({"0", "1", "2"}));
+  EXPECT_EQ(client.queue_depth, 2u);
+  client.finishCall(/* success= */ false);
+  client.finishCall();
+  EXPECT_EQ(client.exported,
+            std::vector<std::string>({"0", "1", "2", "3", "4"}));
+  EXPECT_EQ(queue.size(), 0u);
+  EXPECT_EQ(queue.bytes(), 0);
+  EXPECT_EQ(client.queue_depth, 0u);
+  EXPECT_EQ(client.dropped_entries, 0);
+  EXPECT_EQ(client.done_calls, 0);
+}
+
+// Test that the oldest queued requests are dropped when the queue is full.
+TEST(ExportQueueTest, DropOldest) {
+  FakeExportClient client;
+  const auto requests = makeRequests(5);
+  ExportQueue queue(&client,
+                    queueOption(1, 2 * requests[1].ByteSizeLong(),
+                                PluginConfig::DROP_OLDEST));
+  queue.exportRequests(pointers(requests), /* is_on_done= */ false);
+  EXPECT_EQ(queue.size(), 2u);
+  EXPECT_EQ(queue.bytes(), 2 * static_cast<int64_t>(
+                                   requests[1].ByteSizeLong()));
+  EXPECT_EQ(client.dropped_entries, 4);
+
+  client.finishCall();
+  client.finishCall();
+  EXPECT_EQ(client.exported, std::vector<std::string>({"0", "3", "4"}));
+}
+
+// Test that new requests are dropped when the queue is full.
+TEST(ExportQueueTest, DropNewest) {
+  FakeExportClient client;
+  const auto requests = makeRequests(5);
+  ExportQueue queue(&client,
+                    queueOption(1, 2 * requests[1].ByteSizeLong(),
+                                PluginConfig::DROP_NEWEST));
+  queue.exportRequests(pointers(requests), /* is_on_done= */ false);
+  EXPECT_EQ(queue.size(), 2u);
+  EXPECT_EQ(client.dropped_entries, 4);
+
+  client.finishCall();
+  client.finishCall();
+  EXPECT_EQ(client.exported, std::vector<std::string>({"0", "1", "2"}));
+}
+
+// Test that the queue keeps a sample of the requests when it is full.
+TEST(ExportQueueTest, Sample) {
+  FakeExportClient client;
+  const auto requests = makeRequests(10);
+  ExportQueue queue(&client,
+                    queueOption(1, 2 * requests[1].ByteSizeLong(),
+                                PluginConfig::SAMPLE));
+  queue.exportRequests(pointers(requests), /* is_on_done= */ false);
+  EXPECT_EQ(queue.size(), 2u);
+  EXPECT_EQ(client.dropped_entries, 14);
+
+  client.finishCall();
+  client.finishCall();
+  ASSERT_EQ(client.exported.size(), 3u);
+  // The sampled requests are still exported in order.
+  EXPECT_LT(std::stoi(client.exported[1]), std::stoi(client.exported[2]));
+}
+
+// Test that a request larger than the queue is dropped, keeping the queued
+// ones.
+TEST(ExportQueueTest, DropLargerThanQueue) {
+  FakeExportClient client;
+  auto requests = makeRequests(3);
+  requests[2].set_log_name(std::string(100, '2'));
+  ExportQueue queue(&client,
+                    queueOption(1, requests[2].ByteSizeLong() - 1,
+                                PluginConfig::DROP_OLDEST));
+  queue.exportRequests(pointers(requests), /* is_on_done= */ false);
+  EXPECT_EQ(queue.size(), 1u);
+  EXPECT_EQ(client.dropped_entries, 2);
+}
+
+// Test that requests whose calls cannot be made are queued and retried
+// first on the next export.
+TEST(ExportQueueTest, Retry) {
+  FakeExportClient client;
+  ExportQueue queue(&client,
+                    queueOption(10, 1000000, PluginConfig::DROP_OLDEST));
+  const auto requests = makeRequests(4);
+  client.accept_calls = false;
+  queue.exportRequests(pointers({requests[0], requests[1]}),
+                       /* is_on_done= */ false);
+  EXPECT_TRUE(client.exported.empty());
+  EXPECT_EQ(queue.size(), 2u);
+  EXPECT_EQ(client.queue_depth, 2u);
+
+  client.accept_calls = true;
+  queue.exportRequests(pointers({requests[2], requests[3]}),
+                       /* is_on_done= */ false);
+  EXPECT_EQ(client.exported,
+            std::vector<std::string>({"0", "1", "2", "3"}));
+  EXPECT_EQ(queue.size(), 0u);
+  EXPECT_EQ(queue.bytes(), 0);
+  EXPECT_EQ(client.queue_depth, 0u);
+}
+
+// Test that the export on done finishes once the queue is drained and no call
+// is left in flight.
+TEST(ExportQueueTest, OnDone) {
+  FakeExportClient client;
+  ExportQueue queue(&client,
+                    queueOption(1, 1000000, PluginConfig::DROP_OLDEST));
+  const auto requests = makeRequests(2);
+  queue.exportRequests(pointers(requests), /* is_on_done= */ true);
+  EXPECT_EQ(client.exported, std::vector<std::string>({"0"}));
+
+  client.finishCall();
+  EXPECT_EQ(client.exported, std::vector<std::string>({"0", "1"}));
+  EXPECT_EQ(client.done_calls, 0);
+  client.finishCall(/* success= */ false);
+  EXPECT_EQ(client.done_calls, 1);
+}
+
+}  // namespace
+}  // namespace Log
+}  // namespace Stackdriver
+}  // namespace Extensions
+
+#ifdef NULL_PLUGIN
+}  // namespace Plugin
+}  // namespace Null
+}  // namespace Wasm
+}  // namespace Common
+}  // namespace Extensions
+}  // namespace Envoy
+#endif
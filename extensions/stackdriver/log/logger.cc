@@ -15,8 +15,12 @@
 
 #include "extensions/stackdriver/log/logger.h"
 
+#include <algorithm>
+
+#include "absl/strings/str_cat.h"
 #include "extensions/stackdriver/common/constants.h"
 #include "google/logging/v2/log_entry.pb.h"
+#include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/util/time_util.h"
 
 #ifndef NULL_PLUGIN
@@ -36,12 +40,61 @@ using google::protobuf::util::TimeUtil;
 // Name of the HTTP server access log.
 constexpr char kServerAccessLogName[] = "server-accesslog-stackdriver";
 
+namespace {
+
+using google::protobuf::io::CodedOutputStream;
+
+// Serialized sizes of LogEntry fields, so that the size of an entry is
+// tracked as it is filled. Tags take one byte unless given.
+size_t delimitedSize(size_t length, size_t tag_size = 1) {
+  return tag_size + CodedOutputStream::VarintSize64(length) + length;
+}
+
+size_t stringSize(const std::string& value, size_t tag_size = 1) {
+  return value.empty() ? 0 : delimitedSize(value.size(), tag_size);
+}
+
+size_t int64Size(int64_t value) {
+  return value == 0 ? 0
+                    : 1 + CodedOutputStream::VarintSize64(
+                              static_cast<uint64_t>(value));
+}
+
+size_t int32Size(int32_t value) {
+  return value == 0 ? 0
+                    : 1 + CodedOutputStream::VarintSize32SignExtended(value);
+}
+
+// Map entries always carry both key and value.
+size_t labelSize(const std::string& key, const std::string& value) {
+  return delimitedSize(delimitedSize(key.size()) + delimitedSize(value.size()));
+}
+
+// Timestamp and Duration are both seconds and nanos.
+template <class T>
+size_t timeSize(const T& time) {
+  return delimitedSize(int64Size(time.seconds()) + int32Size(time.nanos()));
+}
+
+size_t httpRequestSize(const google::logging::type::HttpRequest& request) {
+  return delimitedSize(
+      stringSize(request.request_method()) +
+      stringSize(request.request_url()) + int64Size(request.request_size()) +
+      int32Size(request.status()) + int64Size(request.response_size()) +
+      stringSize(request.user_agent()) + stringSize(request.remote_ip()) +
+      stringSize(request.server_ip()) + stringSize(request.referer()) +
+      timeSize(request.latency()) + stringSize(request.protocol()));
+}
+
+absl::string_view stringView(const flatbuffers::String* value) {
+  return value ? absl::string_view(value->c_str(), value->size())
+               : absl::string_view();
+}
+
+}  // namespace
+
 Logger::Logger(const ::Wasm::Common::FlatNode& local_node_info,
                std::unique_ptr<Exporter> exporter, int log_request_size_limit) {
-  // Initalize the current WriteLogEntriesRequest.
-  log_entries_request_ =
-      std::make_unique<google::logging::v2::WriteLogEntriesRequest>();
-
   // Set log names.
   const auto platform_metadata = local_node_info.platform_metadata();
   const auto project_iter =
@@ -50,8 +103,8 @@ Logger::Logger(const ::Wasm::Common::FlatNode& local_node_info,
   if (project_iter) {
     project_id_ = flatbuffers::GetString(project_iter->value());
   }
-  log_entries_request_->set_log_name("projects/" + project_id_ + "/logs/" +
-                                     kServerAccessLogName);
+  request_template_.set_log_name("projects/" + project_id_ + "/logs/" +
+                                 kServerAccessLogName);
 
   std::string resource_type = Common::kContainerMonitoredResource;
   const auto cluster_iter =
@@ -67,10 +120,10 @@ Logger::Logger(const ::Wasm::Common::FlatNode& local_node_info,
   google::api::MonitoredResource monitored_resource;
   Common::getMonitoredResource(resource_type, local_node_info,
                                &monitored_resource);
-  log_entries_request_->mutable_resource()->CopyFrom(monitored_resource);
+  request_template_.mutable_resource()->CopyFrom(monitored_resource);
 
   // Set common labels shared by all entries.
-  auto label_map = log_entries_request_->mutable_labels();
+  auto label_map = request_template_.mutable_labels();
   (*label_map)["destination_name"] =
       flatbuffers::GetString(local_node_info.name());
   (*label_map)["destination_workload"] =
@@ -93,102 +146,206 @@ Logger::Logger(const ::Wasm::Common::FlatNode& local_node_info,
           flatbuffers::GetString(app_iter->value());
     }
   }
+  template_size_ = request_template_.ByteSizeLong();
   log_request_size_limit_ = log_request_size_limit;
   exporter_ = std::move(exporter);
 }
 
 void Logger::addLogEntry(const ::Wasm::Common::RequestInfo& request_info,
-                         const ::Wasm::Common::FlatNode& peer_node_info) {
-  // create a new log entry
-  auto* log_entries = log_entries_request_->mutable_entries();
-  auto* new_entry = log_entries->Add();
-
-  *new_entry->mutable_timestamp() =
-      google::protobuf::util::TimeUtil::NanosecondsToTimestamp(
-          request_info.start_time);
-  new_entry->set_severity(::google::logging::type::INFO);
-  auto label_map = new_entry->mutable_labels();
-  (*label_map)["request_id"] = request_info.request_id;
-  (*label_map)["source_name"] = flatbuffers::GetString(peer_node_info.name());
-  (*label_map)["source_workload"] =
-      flatbuffers::GetString(peer_node_info.workload_name());
-  (*label_map)["source_namespace"] =
-      flatbuffers::GetString(peer_node_info.namespace_());
-  // Add source app and version label if exist.
+                         const ::Wasm::Common::FlatNode& peer_node_info,
+                         double sample_rate) {
+  // Find the entries of the peer labels, or start them.
   const auto peer_labels = peer_node_info.labels();
-  if (peer_labels) {
-    auto version_iter = peer_labels->LookupByKey("version");
+  const auto version_iter =
+      peer_labels ? peer_labels->LookupByKey("version") : nullptr;
+  const auto app_iter = peer_labels ? peer_labels->LookupByKey("app") : nullptr;
+  const auto auth_policy = ::Wasm::Common::AuthenticationPolicyString(
+      request_info.service_auth_policy());
+  // Labels that are not set are told apart from empty ones by the "=" prefix.
+  std::string key = absl::StrCat(
+      stringView(peer_node_info.name()), "\n",
+      stringView(peer_node_info.workload_name()), "\n",
+      stringView(peer_node_info.namespace_()), "\n",
+      version_iter ? "=" : "",
+      stringView(version_iter ? version_iter->value() : nullptr), "\n",
+      app_iter ? "=" : "", stringView(app_iter ? app_iter->value() : nullptr),
+      "\n", request_info.destination_service_host(), "\n",
+      request_info.destination_principal(), "\n",
+      request_info.source_principal(), "\n",
+      absl::string_view(auth_policy.data(), auth_policy.size()));
+  auto iter = peer_entries_.find(key);
+  if (iter == peer_entries_.end()) {
+    PeerEntries peer;
+    peer.entries = google::protobuf::Arena::CreateMessage<
+        google::logging::v2::WriteLogEntriesRequest>(&arena_);
+    auto& labels = peer.labels;
+    labels.emplace_back("source_name",
+                        flatbuffers::GetString(peer_node_info.name()));
+    labels.emplace_back("source_workload",
+                        flatbuffers::GetString(peer_node_info.workload_name()));
+    labels.emplace_back("source_namespace",
+                        flatbuffers::GetString(peer_node_info.namespace_()));
+    // Add source app and version label if exist.
     if (version_iter) {
-      (*label_map)["source_version"] =
-          flatbuffers::GetString(version_iter->value());
+      labels.emplace_back("source_version",
+                          flatbuffers::GetString(version_iter->value()));
     }
-    auto app_iter = peer_labels->LookupByKey("app");
     if (app_iter) {
-      (*label_map)["source_app"] = flatbuffers::GetString(app_iter->value());
+      labels.emplace_back("source_app",
+                          flatbuffers::GetString(app_iter->value()));
     }
+    labels.emplace_back("destination_service_host",
+                        request_info.destination_service_host());
+    labels.emplace_back("destination_principal",
+                        request_info.destination_principal());
+    labels.emplace_back("source_principal", request_info.source_principal());
+    labels.emplace_back("service_authentication_policy",
+                        std::string(auth_policy));
+    peer.labels_size = 0;
+    for (const auto& label : labels) {
+      peer.labels_size += labelSize(label.first, label.second);
+    }
+    peer.size = 0;
+    iter = peer_entries_.emplace(std::move(key), std::move(peer)).first;
   }
+  PeerEntries& peer = iter->second;
+
+  // create a new log entry
+  auto* new_entry = peer.entries->add_entries();
 
-  (*label_map)["destination_service_host"] =
-      request_info.destination_service_host;
-  (*label_map)["response_flag"] = request_info.response_flag;
-  (*label_map)["destination_principal"] = request_info.destination_principal;
-  (*label_map)["source_principal"] = request_info.source_principal;
-  (*label_map)["service_authentication_policy"] =
-      std::string(::Wasm::Common::AuthenticationPolicyString(
-          request_info.service_auth_policy));
+  *new_entry->mutable_timestamp() =
+      google::protobuf::util::TimeUtil::NanosecondsToTimestamp(
+          request_info.start_time());
+  new_entry->set_severity(::google::logging::type::INFO);
+  size_t entry_size = timeSize(new_entry->timestamp()) +
+                      int32Size(::google::logging::type::INFO);
+
+  auto label_map = new_entry->mutable_labels();
+  auto add_label = [label_map, &entry_size](const std::string& key,
+                                            const std::string& value) {
+    entry_size += labelSize(key, value);
+    (*label_map)[key] = value;
+  };
+  add_label("request_id", request_info.request_id());
+  add_label("response_flag", request_info.response_flag());
+  if (sample_rate < 1.0) {
+    add_label("sample_rate", absl::StrCat(sample_rate));
+  }
 
   // Insert HTTPRequest
   auto http_request = new_entry->mutable_http_request();
-  http_request->set_request_method(request_info.request_operation);
-  http_request->set_request_url(request_info.url_scheme + "://" +
-                                request_info.url_host + request_info.url_path);
-  http_request->set_request_size(request_info.request_size);
-  http_request->set_status(request_info.response_code);
-  http_request->set_response_size(request_info.response_size);
-  http_request->set_user_agent(request_info.user_agent);
-  http_request->set_remote_ip(request_info.source_address);
-  http_request->set_server_ip(request_info.destination_address);
-  http_request->set_protocol(request_info.request_protocol);
+  http_request->set_request_method(request_info.request_operation());
+  http_request->set_request_url(request_info.url_scheme() + "://" +
+                                request_info.url_host() +
+                                request_info.url_path());
+  http_request->set_request_size(request_info.request_size());
+  http_request->set_status(request_info.response_code());
+  http_request->set_response_size(request_info.response_size());
+  http_request->set_user_agent(request_info.user_agent());
+  http_request->set_remote_ip(request_info.source_address());
+  http_request->set_server_ip(request_info.destination_address());
+  http_request->set_protocol(request_info.request_protocol());
   *http_request->mutable_latency() =
       google::protobuf::util::TimeUtil::NanosecondsToDuration(
-          request_info.duration);
-  http_request->set_referer(request_info.referer);
+          request_info.duration());
+  http_request->set_referer(request_info.referer());
+  entry_size += httpRequestSize(*http_request);
 
   // Insert trace headers, if exist.
-  if (request_info.b3_trace_sampled) {
+  if (request_info.b3_trace_sampled()) {
     new_entry->set_trace("projects/" + project_id_ + "/traces/" +
-                         request_info.b3_trace_id);
-    new_entry->set_span_id(request_info.b3_span_id);
-    new_entry->set_trace_sampled(request_info.b3_trace_sampled);
+                         request_info.b3_trace_id());
+    new_entry->set_span_id(request_info.b3_span_id());
+    new_entry->set_trace_sampled(request_info.b3_trace_sampled());
+    // trace, span_id and trace_sampled have two byte tags.
+    entry_size += stringSize(new_entry->trace(), 2) +
+                  stringSize(new_entry->span_id(), 2) + 3;
   }
 
-  // Accumulate estimated size of the request. If the current request exceeds
-  // the size limit, flush the request out.
-  size_ += new_entry->ByteSizeLong();
-  if (size_ > log_request_size_limit_) {
-    flush();
+  // Accumulate the size of the entries. If a request of them exceeds the size
+  // limit, queue it for export.
+  peer.entry_sizes.push_back(entry_size);
+  peer.size += delimitedSize(entry_size);
+  if (template_size_ + peer.labels_size + peer.size > log_request_size_limit_) {
+    queuePeerRequest(peer);
+    peer_entries_.erase(iter);
   }
 }
 
+void Logger::queuePeerRequest(PeerEntries& peer) {
+  auto* request = newRequest();
+  request->mutable_entries()->Swap(peer.entries->mutable_entries());
+  auto label_map = request->mutable_labels();
+  for (auto& label : peer.labels) {
+    (*label_map)[label.first] = std::move(label.second);
+  }
+  request_queue_.push_back(request);
+}
+
+google::logging::v2::WriteLogEntriesRequest* Logger::newRequest() {
+  auto* request = google::protobuf::Arena::CreateMessage<
+      google::logging::v2::WriteLogEntriesRequest>(&arena_);
+  request->CopyFrom(request_template_);
+  return request;
+}
+
 bool Logger::flush() {
-  if (size_ == 0) {
+  if (peer_entries_.empty()) {
     // This flush is triggered by timer and does not have any log entries.
     return false;
   }
 
-  // Reconstruct a new WriteLogRequest.
-  std::unique_ptr<google::logging::v2::WriteLogEntriesRequest> cur =
-      std::make_unique<google::logging::v2::WriteLogEntriesRequest>();
-  cur->set_log_name(log_entries_request_->log_name());
-  cur->mutable_resource()->CopyFrom(log_entries_request_->resource());
-  *cur->mutable_labels() = log_entries_request_->labels();
-
-  // Swap the new request with the old one and export it.
-  log_entries_request_.swap(cur);
-  request_queue_.emplace_back(std::move(cur));
+  // Peers with the most entries get requests of their own, so that the
+  // requests of a flush are few.
+  std::vector<PeerEntries*> peers;
+  peers.reserve(peer_entries_.size());
+  for (auto& peer : peer_entries_) {
+    peers.push_back(&peer.second);
+  }
+  const size_t num_peer_requests = std::min(kMaxPeerRequests, peers.size());
+  std::partial_sort(
+      peers.begin(), peers.begin() + num_peer_requests, peers.end(),
+      [](const PeerEntries* a, const PeerEntries* b) {
+        return a->entry_sizes.size() > b->entry_sizes.size();
+      });
+  size_t i = 0;
+  for (; i < num_peer_requests &&
+         peers[i]->entry_sizes.size() >= kMinPeerRequestEntries;
+       i++) {
+    queuePeerRequest(*peers[i]);
+  }
 
-  // Reset size counter.
-  size_ = 0;
+  // Entries of the other peers share requests, carrying their peer labels.
+  google::logging::v2::WriteLogEntriesRequest* shared_request = nullptr;
+  int shared_size = 0;
+  for (; i < peers.size(); i++) {
+    PeerEntries& peer = *peers[i];
+    auto* entries = peer.entries->mutable_entries();
+    for (int j = 0; j < entries->size(); j++) {
+      const int entry_size =
+          delimitedSize(peer.entry_sizes[j] + peer.labels_size);
+      if (shared_request &&
+          shared_size + entry_size > log_request_size_limit_) {
+        request_queue_.push_back(shared_request);
+        shared_request = nullptr;
+      }
+      if (!shared_request) {
+        shared_request = newRequest();
+        shared_size = template_size_;
+      }
+      auto* entry = shared_request->add_entries();
+      entry->Swap(entries->Mutable(j));
+      auto label_map = entry->mutable_labels();
+      for (const auto& label : peer.labels) {
+        (*label_map)[label.first] = label.second;
+      }
+      shared_size += entry_size;
+    }
+  }
+  if (shared_request) {
+    request_queue_.push_back(shared_request);
+  }
+  peer_entries_.clear();
   return true;
 }
 
@@ -199,6 +356,10 @@ bool Logger::exportLogEntry(bool is_on_done) {
   }
   exporter_->exportLogs(request_queue_, is_on_done);
   request_queue_.clear();
+
+  // The exported requests are serialized by the exporter, and no request is
+  // being filled after the flush, so the arena can be reset.
+  arena_.Reset();
   return true;
 }
 
@@ -16,11 +16,13 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "extensions/common/context.h"
 #include "extensions/stackdriver/log/exporter.h"
 #include "google/logging/v2/logging.pb.h"
+#include "google/protobuf/arena.h"
 
 namespace Extensions {
 namespace Stackdriver {
@@ -31,7 +33,23 @@ using Envoy::Extensions::Common::Wasm::Null::Plugin::Extensions::Stackdriver::
     Log::Exporter;
 #endif
 
+// Maximum number of peers whose entries are exported in requests of their own
+// per flush. It is below the default number of export calls in flight, so that
+// the requests of a flush are exported at once.
+constexpr size_t kMaxPeerRequests = 4;
+
+// Minimum number of entries of a peer since the last flush for them to be
+// exported in a request of their own.
+constexpr size_t kMinPeerRequestEntries = 10;
+
 // Logger records access logs and exports them to Stackdriver.
+//
+// Log entries are grouped by their peer labels, i.e. the source and the
+// principal labels, which are nearly constant per peer. On flush, the peers
+// with the most entries get requests of their own, with their labels set on
+// the request as the destination labels are, so that the entries only carry
+// the labels that vary per request. Entries of the other peers share a request
+// and carry their peer labels.
 class Logger {
  public:
   // Logger initiate a Stackdriver access logger, which batches log entries and
@@ -43,9 +61,11 @@ class Logger {
          int log_request_size_limit = 4000000 /* 4 Mb */);
 
   // Add a new log entry based on the given request information and peer node
-  // information.
+  // information. sample_rate is the probability that the request was logged
+  // with, which is recorded in the entry if it is below 1.
   void addLogEntry(const ::Wasm::Common::RequestInfo &request_info,
-                   const ::Wasm::Common::FlatNode &peer_node_info);
+                   const ::Wasm::Common::FlatNode &peer_node_info,
+                   double sample_rate = 1.0);
 
   // Export and clean the buffered WriteLogEntriesRequests. Returns true if
   // async call is made to export log entry, otherwise returns false if nothing
@@ -53,25 +73,50 @@ class Logger {
   bool exportLogEntry(bool is_on_done);
 
  private:
-  // Flush rotates the current WriteLogEntriesRequest. This will be triggered
-  // either by a timer or by request size limit. Returns false if there is no
-  // log entry to be exported.
+  // Flush queues the log entries added since the last flush into
+  // WriteLogEntriesRequests. Returns false if there is no log entry to be
+  // exported.
   bool flush();
 
+  // Allocates a new WriteLogEntriesRequest from the template on the arena.
+  google::logging::v2::WriteLogEntriesRequest* newRequest();
+
+  // Log entries of a peer added since the last flush.
+  struct PeerEntries {
+    // Holds the entries, without the peer labels.
+    google::logging::v2::WriteLogEntriesRequest* entries;
+    // Peer labels, set either on the request or on each entry on export.
+    std::vector<std::pair<std::string, std::string>> labels;
+    // Serialized size of the peer labels in a map.
+    int labels_size;
+    // Serialized sizes of the entries, without the peer labels.
+    std::vector<int> entry_sizes;
+    // Serialized size of the entries in a request.
+    int size;
+  };
+
+  // Queues a request of the entries of a peer, with the peer labels set on
+  // the request.
+  void queuePeerRequest(PeerEntries& peer);
+
+  // Arena that WriteLogEntriesRequests are allocated on. It is reset once the
+  // queued requests are exported.
+  google::protobuf::Arena arena_;
+
+  // Log name, monitored resource and common labels of all requests.
+  google::logging::v2::WriteLogEntriesRequest request_template_;
+  // Serialized size of the template.
+  int template_size_;
+
   // Buffer for WriteLogEntriesRequests that are to be exported.
-  std::vector<
-      std::unique_ptr<const google::logging::v2::WriteLogEntriesRequest>>
+  std::vector<const google::logging::v2::WriteLogEntriesRequest*>
       request_queue_;
 
-  // Request that the new log entry should be written into.
-  std::unique_ptr<google::logging::v2::WriteLogEntriesRequest>
-      log_entries_request_;
-
-  // Estimated size of the current WriteLogEntriesRequest.
-  int size_ = 0;
+  // Entries added since the last flush, keyed by their peer labels.
+  std::unordered_map<std::string, PeerEntries> peer_entries_;
 
-  // Size limit of a WriteLogEntriesRequest. If current WriteLogEntriesRequest
-  // exceeds this size limit, flush() will be triggered.
+  // Size limit of a WriteLogEntriesRequest. If a WriteLogEntriesRequest
+  // exceeds this size limit, it is queued for export.
   int log_request_size_limit_;
 
   // Exporter calls Stackdriver services to export access logs.
@@ -37,8 +37,8 @@ namespace {
 class MockExporter : public Exporter {
  public:
   MOCK_METHOD2(exportLogs,
-               void(const std::vector<std::unique_ptr<
-                        const google::logging::v2::WriteLogEntriesRequest>>&,
+               void(const std::vector<
+                        const google::logging::v2::WriteLogEntriesRequest*>&,
                     bool));
 };
 
@@ -101,27 +101,27 @@ const ::Wasm::Common::FlatNode& peerNodeInfo(
 
 ::Wasm::Common::RequestInfo requestInfo() {
   ::Wasm::Common::RequestInfo request_info;
-  request_info.start_time = 0;
-  request_info.request_operation = "GET";
-  request_info.destination_service_host = "httpbin.org";
-  request_info.response_flag = "-";
-  request_info.request_protocol = "HTTP";
-  request_info.destination_principal = "destination_principal";
-  request_info.source_principal = "source_principal";
-  request_info.service_auth_policy =
-      ::Wasm::Common::ServiceAuthenticationPolicy::MutualTLS;
-  request_info.duration = 10000000000;  // 10s in nanoseconds
-  request_info.url_scheme = "http";
-  request_info.url_host = "httpbin.org";
-  request_info.url_path = "/headers";
-  request_info.request_id = "123";
-  request_info.b3_trace_id = "123abc";
-  request_info.b3_span_id = "abc123";
-  request_info.b3_trace_sampled = true;
-  request_info.user_agent = "chrome";
-  request_info.referer = "www.google.com";
-  request_info.source_address = "1.1.1.1";
-  request_info.destination_address = "2.2.2.2";
+  request_info.set_start_time(0);
+  request_info.set_request_operation("GET");
+  request_info.set_destination_service_host("httpbin.org");
+  request_info.set_response_flag("-");
+  request_info.set_request_protocol("HTTP");
+  request_info.set_destination_principal("destination_principal");
+  request_info.set_source_principal("source_principal");
+  request_info.set_service_auth_policy(
+      ::Wasm::Common::ServiceAuthenticationPolicy::MutualTLS);
+  request_info.set_duration(10000000000);  // 10s in nanoseconds
+  request_info.set_url_scheme("http");
+  request_info.set_url_host("httpbin.org");
+  request_info.set_url_path("/headers");
+  request_info.set_request_id("123");
+  request_info.set_b3_trace_id("123abc");
+  request_info.set_b3_span_id("abc123");
+  request_info.set_b3_trace_sampled(true);
+  request_info.set_user_agent("chrome");
+  request_info.set_referer("www.google.com");
+  request_info.set_source_address("1.1.1.1");
+  request_info.set_destination_address("2.2.2.2");
   return request_info;
 }
 
@@ -188,6 +188,25 @@ google::logging::v2::WriteLogEntriesRequest expectedRequest(
   return req;
 }
 
+// Expected request of the entries of a peer with enough of them, whose peer
+// labels are set on the request rather than on each entry.
+google::logging::v2::WriteLogEntriesRequest expectedPeerRequest(
+    int log_entry_count) {
+  auto req = expectedRequest(log_entry_count);
+  for (auto& entry : *req.mutable_entries()) {
+    auto* labels = entry.mutable_labels();
+    for (auto iter = labels->begin(); iter != labels->end();) {
+      if (iter->first == "request_id" || iter->first == "response_flag") {
+        ++iter;
+        continue;
+      }
+      (*req.mutable_labels())[iter->first] = iter->second;
+      iter = labels->erase(iter);
+    }
+  }
+  return req;
+}
+
 }  // namespace
 
 TEST(LoggerTest, TestWriteLogEntry) {
@@ -198,8 +217,8 @@ TEST(LoggerTest, TestWriteLogEntry) {
   logger->addLogEntry(requestInfo(), peerNodeInfo(peer));
   EXPECT_CALL(*exporter_ptr, exportLogs(::testing::_, ::testing::_))
       .WillOnce(::testing::Invoke(
-          [](const std::vector<std::unique_ptr<
-                 const google::logging::v2::WriteLogEntriesRequest>>& requests,
+          [](const std::vector<
+                 const google::logging::v2::WriteLogEntriesRequest*>& requests,
              bool) {
             for (const auto& req : requests) {
               std::string diff;
@@ -217,22 +236,66 @@ TEST(LoggerTest, TestWriteLogEntryRotation) {
   auto exporter = std::make_unique<::testing::NiceMock<MockExporter>>();
   auto exporter_ptr = exporter.get();
   flatbuffers::FlatBufferBuilder local, peer;
-  auto logger =
-      std::make_unique<Logger>(nodeInfo(local), std::move(exporter), 1200);
+  // Requests of a peer are queued once a third entry exceeds the limit.
+  auto logger = std::make_unique<Logger>(
+      nodeInfo(local), std::move(exporter),
+      expectedPeerRequest(3).ByteSizeLong() - 1);
   for (int i = 0; i < 9; i++) {
     logger->addLogEntry(requestInfo(), peerNodeInfo(peer));
   }
   EXPECT_CALL(*exporter_ptr, exportLogs(::testing::_, ::testing::_))
       .WillOnce(::testing::Invoke(
-          [](const std::vector<std::unique_ptr<
-                 const google::logging::v2::WriteLogEntriesRequest>>& requests,
+          [](const std::vector<
+                 const google::logging::v2::WriteLogEntriesRequest*>& requests,
+             bool) {
+            EXPECT_EQ(requests.size(), 3);
+            for (const auto& req : requests) {
+              std::string diff;
+              MessageDifferencer differ;
+              differ.ReportDifferencesToString(&diff);
+              if (!differ.Compare(expectedPeerRequest(3), *req)) {
+                FAIL() << "unexpected log entry " << diff << "\n";
+              }
+            }
+          }));
+  logger->exportLogEntry(/* is_on_done = */ false);
+}
+
+TEST(LoggerTest, TestWriteLogEntrySharedRotation) {
+  auto exporter = std::make_unique<::testing::NiceMock<MockExporter>>();
+  auto exporter_ptr = exporter.get();
+  flatbuffers::FlatBufferBuilder local, peer;
+  // Shared requests take three entries, with their peer labels.
+  auto limit_request = expectedRequest(3);
+  for (auto& entry : *limit_request.mutable_entries()) {
+    (*entry.mutable_labels())["source_principal"] = "principal_0";
+  }
+  auto logger = std::make_unique<Logger>(nodeInfo(local), std::move(exporter),
+                                         limit_request.ByteSizeLong());
+  for (int i = 0; i < 9; i++) {
+    auto request_info = requestInfo();
+    request_info.set_source_principal("principal_" + std::to_string(i % 3));
+    logger->addLogEntry(request_info, peerNodeInfo(peer));
+  }
+  EXPECT_CALL(*exporter_ptr, exportLogs(::testing::_, ::testing::_))
+      .WillOnce(::testing::Invoke(
+          [](const std::vector<
+                 const google::logging::v2::WriteLogEntriesRequest*>& requests,
              bool) {
+            // The entries of a peer are kept together.
             EXPECT_EQ(requests.size(), 3);
             for (const auto& req : requests) {
+              ASSERT_GT(req->entries_size(), 0);
+              const auto& principal =
+                  req->entries(0).labels().at("source_principal");
+              auto expected = expectedRequest(3);
+              for (auto& entry : *expected.mutable_entries()) {
+                (*entry.mutable_labels())["source_principal"] = principal;
+              }
               std::string diff;
               MessageDifferencer differ;
               differ.ReportDifferencesToString(&diff);
-              if (!differ.Compare(expectedRequest(3), *req)) {
+              if (!differ.Compare(expected, *req)) {
                 FAIL() << "unexpected log entry " << diff << "\n";
               }
             }
@@ -240,6 +303,134 @@ TEST(LoggerTest, TestWriteLogEntryRotation) {
   logger->exportLogEntry(/* is_on_done = */ false);
 }
 
+TEST(LoggerTest, TestWriteLogEntryPerPeer) {
+  auto exporter = std::make_unique<::testing::NiceMock<MockExporter>>();
+  auto exporter_ptr = exporter.get();
+  flatbuffers::FlatBufferBuilder local, peer;
+  auto logger = std::make_unique<Logger>(nodeInfo(local), std::move(exporter));
+  auto other_request_info = requestInfo();
+  other_request_info.set_source_principal("other_principal");
+  logger->addLogEntry(other_request_info, peerNodeInfo(peer));
+  for (size_t i = 0; i < kMinPeerRequestEntries; i++) {
+    logger->addLogEntry(requestInfo(), peerNodeInfo(peer));
+  }
+  EXPECT_CALL(*exporter_ptr, exportLogs(::testing::_, ::testing::_))
+      .WillOnce(::testing::Invoke(
+          [](const std::vector<
+                 const google::logging::v2::WriteLogEntriesRequest*>& requests,
+             bool) {
+            // The peer with enough entries gets a request of its own, with
+            // its labels set on the request.
+            ASSERT_EQ(requests.size(), 2);
+            auto other_request = expectedRequest(1);
+            (*other_request.mutable_entries(0)
+                  ->mutable_labels())["source_principal"] = "other_principal";
+            for (const auto& req : requests) {
+              std::string diff;
+              MessageDifferencer differ;
+              differ.ReportDifferencesToString(&diff);
+              const auto& expected =
+                  req->labels().count("source_principal") > 0
+                      ? expectedPeerRequest(kMinPeerRequestEntries)
+                      : other_request;
+              if (!differ.Compare(expected, *req)) {
+                FAIL() << "unexpected log entry " << diff << "\n";
+              }
+            }
+          }));
+  logger->exportLogEntry(/* is_on_done = */ false);
+}
+
+TEST(LoggerTest, TestWriteLogEntryManyPeers) {
+  auto exporter = std::make_unique<::testing::NiceMock<MockExporter>>();
+  auto exporter_ptr = exporter.get();
+  flatbuffers::FlatBufferBuilder local, peer;
+  auto logger = std::make_unique<Logger>(nodeInfo(local), std::move(exporter));
+  // The peers with the most entries get requests of their own. The next peer
+  // has enough entries but shares a request with the peer below the minimum.
+  for (size_t i = 0; i <= kMaxPeerRequests + 1; i++) {
+    auto request_info = requestInfo();
+    request_info.set_source_principal("principal_" + std::to_string(i));
+    for (size_t j = 0; j < kMinPeerRequestEntries + kMaxPeerRequests - i;
+         j++) {
+      logger->addLogEntry(request_info, peerNodeInfo(peer));
+    }
+  }
+  EXPECT_CALL(*exporter_ptr, exportLogs(::testing::_, ::testing::_))
+      .WillOnce(::testing::Invoke(
+          [](const std::vector<
+                 const google::logging::v2::WriteLogEntriesRequest*>& requests,
+             bool) {
+            ASSERT_EQ(requests.size(), kMaxPeerRequests + 1);
+            int shared_requests = 0;
+            for (const auto& req : requests) {
+              if (req->labels().count("source_principal") > 0) {
+                EXPECT_GT(req->entries_size(), kMinPeerRequestEntries);
+                continue;
+              }
+              shared_requests++;
+              EXPECT_EQ(req->entries_size(), 2 * kMinPeerRequestEntries - 1);
+            }
+            EXPECT_EQ(shared_requests, 1);
+          }));
+  logger->exportLogEntry(/* is_on_done = */ false);
+}
+
+TEST(LoggerTest, TestWriteSampledLogEntry) {
+  auto exporter = std::make_unique<::testing::NiceMock<MockExporter>>();
+  auto exporter_ptr = exporter.get();
+  flatbuffers::FlatBufferBuilder local, peer;
+  auto logger = std::make_unique<Logger>(nodeInfo(local), std::move(exporter));
+  logger->addLogEntry(requestInfo(), peerNodeInfo(peer), 0.25);
+  EXPECT_CALL(*exporter_ptr, exportLogs(::testing::_, ::testing::_))
+      .WillOnce(::testing::Invoke(
+          [](const std::vector<
+                 const google::logging::v2::WriteLogEntriesRequest*>& requests,
+             bool) {
+            auto expected = expectedRequest(1);
+            (*expected.mutable_entries(0)->mutable_labels())["sample_rate"] =
+                "0.25";
+            for (const auto& req : requests) {
+              std::string diff;
+              MessageDifferencer differ;
+              differ.ReportDifferencesToString(&diff);
+              if (!differ.Compare(expected, *req)) {
+                FAIL() << "unexpected log entry " << diff << "\n";
+              }
+            }
+          }));
+  logger->exportLogEntry(/* is_on_done = */ false);
+}
+
+TEST(LoggerTest, TestWriteLogEntryAfterExport) {
+  auto exporter = std::make_unique<::testing::NiceMock<MockExporter>>();
+  auto exporter_ptr = exporter.get();
+  flatbuffers::FlatBufferBuilder local, peer;
+  auto logger = std::make_unique<Logger>(nodeInfo(local), std::move(exporter));
+  EXPECT_CALL(*exporter_ptr, exportLogs(::testing::_, ::testing::_))
+      .Times(2)
+      .WillRepeatedly(::testing::Invoke(
+          [](const std::vector<
+                 const google::logging::v2::WriteLogEntriesRequest*>& requests,
+             bool) {
+            EXPECT_EQ(requests.size(), 1);
+            for (const auto& req : requests) {
+              std::string diff;
+              MessageDifferencer differ;
+              differ.ReportDifferencesToString(&diff);
+              if (!differ.Compare(expectedRequest(1), *req)) {
+                FAIL() << "unexpected log entry " << diff << "\n";
+              }
+            }
+          }));
+  // Requests made after an export still carry the common fields.
+  for (int i = 0; i < 2; i++) {
+    logger->addLogEntry(requestInfo(), peerNodeInfo(peer));
+    EXPECT_TRUE(logger->exportLogEntry(/* is_on_done = */ false));
+  }
+  EXPECT_FALSE(logger->exportLogEntry(/* is_on_done = */ false));
+}
+
 }  // namespace Log
 }  // namespace Stackdriver
 }  // namespace Extensions
@@ -0,0 +1,99 @@
+/* Copyright 2020 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "extensions/stackdriver/log/sampler.h"
+
+#include <algorithm>
+
+#include "absl/strings/str_cat.h"
+
+namespace Extensions {
+namespace Stackdriver {
+namespace Log {
+
+constexpr int64_t kWindowNanoseconds = 1000000000;  // 1s
+
+Sampler::Window& Sampler::classWindow(std::string&& key, int64_t now_nanos) {
+  auto iter = windows_.find(key);
+  if (iter != windows_.end()) {
+    return iter->second;
+  }
+  if (windows_.size() >= kMaxSampledClasses &&
+      now_nanos - last_eviction_ >= kWindowNanoseconds) {
+    // Windows that started two windows ago count nothing anymore.
+    last_eviction_ = now_nanos;
+    for (auto it = windows_.begin(); it != windows_.end();) {
+      if (now_nanos - it->second.start >= 2 * kWindowNanoseconds) {
+        it = windows_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  if (windows_.size() >= kMaxSampledClasses) {
+    return overflow_window_;
+  }
+  return windows_.emplace(std::move(key), Window{now_nanos, 0, 0})
+      .first->second;
+}
+
+double Sampler::sample(const ::Wasm::Common::FlatNode& peer_node_info,
+                       const ::Wasm::Common::RequestInfo& request_info,
+                       int64_t now_nanos) {
+  const uint32_t response_code = request_info.response_code();
+  if (response_code == 0 || response_code >= 400) {
+    return 1.0;
+  }
+  if (request_info.request_protocol() == ::Wasm::Common::kProtocolGRPC &&
+      request_info.grpc_status() != 0) {
+    return 1.0;
+  }
+
+  const auto workload = peer_node_info.workload_name();
+  Window& window = classWindow(
+      absl::StrCat(workload ? absl::string_view(workload->c_str(),
+                                                workload->size())
+                            : absl::string_view(),
+                   "/", response_code / 100),
+      now_nanos);
+  const int64_t elapsed = now_nanos - window.start;
+  if (elapsed >= kWindowNanoseconds) {
+    // The previous window only counts if it just ended.
+    window.previous_count = elapsed < 2 * kWindowNanoseconds ? window.count : 0;
+    window.start = now_nanos;
+    window.count = 0;
+  }
+  window.count++;
+
+  // Requests are expected up to the count of the previous window, and the
+  // ones past it keep sum(rate * expected / count^2) <= rate more entries.
+  const double expected = std::max<double>(window.previous_count,
+                                           max_entries_per_second_);
+  const double count = window.count;
+  const double sample_rate =
+      count <= expected ? max_entries_per_second_ / expected
+                        : max_entries_per_second_ * expected / (count * count);
+  if (sample_rate >= 1.0) {
+    return 1.0;
+  }
+  if (uniform_(random_) >= sample_rate) {
+    return 0.0;
+  }
+  return sample_rate;
+}
+
+}  // namespace Log
+}  // namespace Stackdriver
+}  // namespace Extensions
@@ -0,0 +1,83 @@
+/* Copyright 2020 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "extensions/common/context.h"
+
+namespace Extensions {
+namespace Stackdriver {
+namespace Log {
+
+// Maximum number of source workload and response classes a Sampler has
+// windows for. Classes seen once it is reached share a single window until
+// idle classes are evicted.
+constexpr size_t kMaxSampledClasses = 1000;
+
+// Sampler limits the rate of server access log entries. Requests are counted
+// per source workload and response class, by one second windows. A class that
+// saw more requests than the rate in the previous window has its requests kept
+// at random with the probability that brings that count down to the rate.
+// Requests beyond that count in the current window are kept with a
+// probability falling with the square of their count, so a window keeps at
+// most about twice the rate in expectation when a spike starts. Every request
+// is kept with the probability returned, so that backends can reweight the
+// entries by it. Client and server errors, gRPC errors and requests without a
+// response are always kept.
+class Sampler {
+ public:
+  // max_entries_per_second is the rate of each class.
+  explicit Sampler(double max_entries_per_second)
+      : max_entries_per_second_(max_entries_per_second) {}
+
+  // Returns the probability that the request was kept with, or 0 if it is
+  // dropped. now_nanos is the current time in nanoseconds.
+  double sample(const ::Wasm::Common::FlatNode& peer_node_info,
+                const ::Wasm::Common::RequestInfo& request_info,
+                int64_t now_nanos);
+
+ private:
+  struct Window {
+    // Start of the current window.
+    int64_t start = 0;
+    // Requests seen in the previous and the current window.
+    int64_t previous_count = 0;
+    int64_t count = 0;
+  };
+
+  // Returns the window of the class, evicting the idle classes if there are
+  // too many.
+  Window& classWindow(std::string&& key, int64_t now_nanos);
+
+  double max_entries_per_second_;
+
+  // Windows of the classes, keyed by source workload and response class.
+  std::unordered_map<std::string, Window> windows_;
+  // Window shared by the classes seen while windows_ is full.
+  Window overflow_window_;
+  // Last time windows_ was scanned for idle classes.
+  int64_t last_eviction_ = 0;
+
+  std::minstd_rand random_;
+  std::uniform_real_distribution<double> uniform_;
+};
+
+}  // namespace Log
+}  // namespace Stackdriver
+}  // namespace Extensions
@@ -0,0 +1,169 @@
+/* Copyright 2020 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "extensions/stackdriver/log/sampler.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace Extensions {
+namespace Stackdriver {
+namespace Log {
+
+namespace {
+
+constexpr int64_t kSecond = 1000000000;
+
+const ::Wasm::Common::FlatNode& peerNodeInfo(
+    flatbuffers::FlatBufferBuilder& fbb, const std::string& workload) {
+  auto workload_name = fbb.CreateString(workload);
+  ::Wasm::Common::FlatNodeBuilder node(fbb);
+  node.add_workload_name(workload_name);
+  auto data = node.Finish();
+  fbb.Finish(data);
+  return *flatbuffers::GetRoot<::Wasm::Common::FlatNode>(
+      fbb.GetBufferPointer());
+}
+
+::Wasm::Common::RequestInfo requestInfo(uint32_t response_code) {
+  ::Wasm::Common::RequestInfo request_info;
+  request_info.set_response_code(response_code);
+  request_info.set_request_protocol("http");
+  return request_info;
+}
+
+::Wasm::Common::RequestInfo grpcRequestInfo(uint32_t grpc_status) {
+  ::Wasm::Common::RequestInfo request_info;
+  request_info.set_response_code(200);
+  request_info.set_request_protocol(::Wasm::Common::kProtocolGRPC);
+  request_info.set_grpc_status(grpc_status);
+  return request_info;
+}
+
+}  // namespace
+
+TEST(SamplerTest, KeepsRequestsUnderRate) {
+  Sampler sampler(10);
+  flatbuffers::FlatBufferBuilder fbb;
+  const auto& peer = peerNodeInfo(fbb, "productpage-v1");
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(1.0, sampler.sample(peer, requestInfo(200), i));
+  }
+  // Requests of the next window are counted again.
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(1.0, sampler.sample(peer, requestInfo(200), kSecond + i));
+  }
+}
+
+TEST(SamplerTest, SamplesRequestsOverRate) {
+  Sampler sampler(10);
+  flatbuffers::FlatBufferBuilder fbb;
+  const auto& peer = peerNodeInfo(fbb, "productpage-v1");
+  for (int i = 0; i < 1000; i++) {
+    sampler.sample(peer, requestInfo(200), i);
+  }
+
+  // The next window is sampled at the rate of the previous one.
+  int kept = 0;
+  for (int i = 0; i < 1000; i++) {
+    const double sample_rate =
+        sampler.sample(peer, requestInfo(200), kSecond + i);
+    if (sample_rate > 0) {
+      EXPECT_DOUBLE_EQ(0.01, sample_rate);
+      kept++;
+    }
+  }
+  EXPECT_GT(kept, 0);
+  EXPECT_LT(kept, 40);
+}
+
+TEST(SamplerTest, SpikeKeepsRate) {
+  Sampler sampler(10);
+  flatbuffers::FlatBufferBuilder fbb;
+  const auto& peer = peerNodeInfo(fbb, "productpage-v1");
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(1.0, sampler.sample(peer, requestInfo(200), i));
+  }
+  // The window the spike starts keeps about twice the rate, and the entries
+  // record the probability they were kept with.
+  int kept = 0;
+  for (int i = 10; i < 100000; i++) {
+    const double sample_rate = sampler.sample(peer, requestInfo(200), i);
+    if (sample_rate > 0) {
+      const double count = i + 1;
+      EXPECT_DOUBLE_EQ(10 * 10 / (count * count), sample_rate);
+      kept++;
+    }
+  }
+  EXPECT_LT(kept, 30);
+}
+
+TEST(SamplerTest, KeepsErrors) {
+  Sampler sampler(1);
+  flatbuffers::FlatBufferBuilder fbb;
+  const auto& peer = peerNodeInfo(fbb, "productpage-v1");
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(1.0, sampler.sample(peer, requestInfo(503), i));
+    EXPECT_EQ(1.0, sampler.sample(peer, requestInfo(404), i));
+    EXPECT_EQ(1.0, sampler.sample(peer, requestInfo(0), i));
+    EXPECT_EQ(1.0, sampler.sample(peer, grpcRequestInfo(14), i));
+  }
+  EXPECT_EQ(1.0, sampler.sample(peer, grpcRequestInfo(0), 0));
+  EXPECT_GT(1.0, sampler.sample(peer, grpcRequestInfo(0), 0));
+}
+
+TEST(SamplerTest, CountsClassesApart) {
+  Sampler sampler(1);
+  flatbuffers::FlatBufferBuilder productpage, reviews;
+  const auto& productpage_peer = peerNodeInfo(productpage, "productpage-v1");
+  const auto& reviews_peer = peerNodeInfo(reviews, "reviews-v1");
+  EXPECT_EQ(1.0, sampler.sample(productpage_peer, requestInfo(200), 0));
+  EXPECT_EQ(1.0, sampler.sample(productpage_peer, requestInfo(301), 0));
+  EXPECT_EQ(1.0, sampler.sample(reviews_peer, requestInfo(200), 0));
+  EXPECT_GT(1.0, sampler.sample(reviews_peer, requestInfo(200), 0));
+}
+
+TEST(SamplerTest, TooManyClasses) {
+  Sampler sampler(1);
+  std::vector<flatbuffers::FlatBufferBuilder> fbbs(kMaxSampledClasses + 2);
+  std::vector<const ::Wasm::Common::FlatNode*> peers;
+  for (size_t i = 0; i < fbbs.size(); i++) {
+    peers.push_back(&peerNodeInfo(fbbs[i], "workload-" + std::to_string(i)));
+  }
+  for (size_t i = 0; i < kMaxSampledClasses; i++) {
+    EXPECT_EQ(1.0, sampler.sample(*peers[i], requestInfo(200), 0));
+  }
+  // The tracked classes are still sampled, and the new ones share a window.
+  EXPECT_GT(1.0, sampler.sample(*peers[0], requestInfo(200), 0));
+  const auto& extra_peer = *peers[kMaxSampledClasses];
+  const auto& other_extra_peer = *peers[kMaxSampledClasses + 1];
+  EXPECT_EQ(1.0, sampler.sample(extra_peer, requestInfo(200), 0));
+  EXPECT_GT(1.0, sampler.sample(other_extra_peer, requestInfo(200), 0));
+
+  // Idle classes are evicted to make room for the new ones.
+  EXPECT_EQ(1.0, sampler.sample(*peers[1], requestInfo(200), kSecond));
+  EXPECT_EQ(1.0,
+            sampler.sample(other_extra_peer, requestInfo(200), 2 * kSecond));
+  EXPECT_GT(1.0,
+            sampler.sample(other_extra_peer, requestInfo(200), 2 * kSecond));
+  EXPECT_EQ(1.0, sampler.sample(*peers[1], requestInfo(200), 2 * kSecond));
+  EXPECT_GT(1.0, sampler.sample(*peers[1], requestInfo(200), 2 * kSecond));
+}
+
+}  // namespace Log
+}  // namespace Stackdriver
+}  // namespace Extensions
@@ -15,6 +15,9 @@
 
 #include "extensions/stackdriver/metric/record.h"
 
+#include <vector>
+
+#include "absl/strings/str_cat.h"
 #include "extensions/stackdriver/common/constants.h"
 #include "extensions/stackdriver/metric/registry.h"
 #include "google/protobuf/util/time_util.h"
@@ -30,14 +33,18 @@ constexpr char kCanonicalRevisionLabel[] =
     "service.istio.io/canonical-revision";
 constexpr char kLatest[] = "latest";
 
-void record(bool is_outbound, const ::Wasm::Common::FlatNode& local_node_info,
-            const ::Wasm::Common::FlatNode& peer_node_info,
-            const ::Wasm::Common::RequestInfo& request_info) {
-  double latency_ms = request_info.duration /* in nanoseconds */ / 1000000.0;
+namespace {
+
+using TagValues = std::vector<std::pair<opencensus::tags::TagKey, std::string>>;
+
+TagValues tagValues(bool is_outbound,
+                    const ::Wasm::Common::FlatNode& local_node_info,
+                    const ::Wasm::Common::FlatNode& peer_node_info,
+                    const ::Wasm::Common::RequestInfo& request_info) {
   const auto& operation =
-      request_info.request_protocol == ::Wasm::Common::kProtocolGRPC
-          ? request_info.request_url_path
-          : request_info.request_operation;
+      request_info.request_protocol() == ::Wasm::Common::kProtocolGRPC
+          ? request_info.request_url_path()
+          : request_info.request_operation();
 
   const auto local_labels = local_node_info.labels();
   const auto peer_labels = peer_node_info.labels();
@@ -64,91 +71,144 @@ void record(bool is_outbound, const ::Wasm::Common::FlatNode& local_node_info,
   const auto peer_canonical_rev =
       peer_rev_iter ? peer_rev_iter->value() : nullptr;
 
+  const auto& source_node_info = is_outbound ? local_node_info : peer_node_info;
+  const auto& destination_node_info =
+      is_outbound ? peer_node_info : local_node_info;
+  const auto source_canonical_name =
+      is_outbound ? local_canonical_name : peer_canonical_name;
+  const auto destination_canonical_name =
+      is_outbound ? peer_canonical_name : local_canonical_name;
+  const auto source_canonical_rev =
+      is_outbound ? local_canonical_rev : peer_canonical_rev;
+  const auto destination_canonical_rev =
+      is_outbound ? peer_canonical_rev : local_canonical_rev;
+
+  return {
+      {meshUIDKey(), flatbuffers::GetString(local_node_info.mesh_id())},
+      {requestOperationKey(), operation},
+      {requestProtocolKey(), request_info.request_protocol()},
+      {serviceAuthenticationPolicyKey(),
+       std::string(::Wasm::Common::AuthenticationPolicyString(
+           request_info.service_auth_policy()))},
+      {destinationServiceNameKey(), request_info.destination_service_name()},
+      {destinationServiceNamespaceKey(),
+       flatbuffers::GetString(destination_node_info.namespace_())},
+      {destinationPortKey(), std::to_string(request_info.destination_port())},
+      {responseCodeKey(), std::to_string(request_info.response_code())},
+      {sourcePrincipalKey(), request_info.source_principal()},
+      {sourceWorkloadNameKey(),
+       flatbuffers::GetString(source_node_info.workload_name())},
+      {sourceWorkloadNamespaceKey(),
+       flatbuffers::GetString(source_node_info.namespace_())},
+      {sourceOwnerKey(), flatbuffers::GetString(source_node_info.owner())},
+      {destinationPrincipalKey(), request_info.destination_principal()},
+      {destinationWorkloadNameKey(),
+       flatbuffers::GetString(destination_node_info.workload_name())},
+      {destinationWorkloadNamespaceKey(),
+       flatbuffers::GetString(destination_node_info.namespace_())},
+      {destinationOwnerKey(),
+       flatbuffers::GetString(destination_node_info.owner())},
+      {destinationCanonicalServiceNameKey(),
+       flatbuffers::GetString(destination_canonical_name)},
+      {destinationCanonicalServiceNamespaceKey(),
+       flatbuffers::GetString(destination_node_info.namespace_())},
+      {destinationCanonicalRevisionKey(),
+       destination_canonical_rev ? destination_canonical_rev->str() : kLatest},
+      {sourceCanonicalServiceNameKey(),
+       flatbuffers::GetString(source_canonical_name)},
+      {sourceCanonicalServiceNamespaceKey(),
+       flatbuffers::GetString(source_node_info.namespace_())},
+      {sourceCanonicalRevisionKey(),
+       source_canonical_rev ? source_canonical_rev->str() : kLatest}};
+}
+
+// Key of the tags of a request. The peer ID stands for the tags read from the
+// peer node, the local node being the same for all requests of a recorder.
+std::string tagsKey(bool is_outbound, const std::string& peer_id,
+                    const ::Wasm::Common::RequestInfo& request_info) {
+  const auto& operation =
+      request_info.request_protocol() == ::Wasm::Common::kProtocolGRPC
+          ? request_info.request_url_path()
+          : request_info.request_operation();
+  return absl::StrCat(
+      is_outbound ? "o" : "i", "\n", peer_id, "\n",
+      request_info.destination_service_name(), "\n", operation, "\n",
+      request_info.request_protocol(), "\n",
+      static_cast<int>(request_info.service_auth_policy()), "\n",
+      request_info.destination_port(), "\n", request_info.response_code(),
+      "\n", request_info.source_principal(), "\n",
+      request_info.destination_principal());
+}
+
+void recordCount(bool is_outbound, int64_t count,
+                 const opencensus::tags::TagMap& tags) {
+  opencensus::stats::Record({{is_outbound ? clientRequestCountMeasure()
+                                          : serverRequestCountMeasure(),
+                              count}},
+                            tags);
+}
+
+void recordSizes(bool is_outbound,
+                 const ::Wasm::Common::RequestInfo& request_info,
+                 const opencensus::tags::TagMap& tags) {
+  double latency_ms = request_info.duration() /* in nanoseconds */ / 1000000.0;
   if (is_outbound) {
     opencensus::stats::Record(
-        {{clientRequestCountMeasure(), 1},
-         {clientRequestBytesMeasure(), request_info.request_size},
-         {clientResponseBytesMeasure(), request_info.response_size},
+        {{clientRequestBytesMeasure(), request_info.request_size()},
+         {clientResponseBytesMeasure(), request_info.response_size()},
          {clientRoundtripLatenciesMeasure(), latency_ms}},
-        {{meshUIDKey(), flatbuffers::GetString(local_node_info.mesh_id())},
-         {requestOperationKey(), operation},
-         {requestProtocolKey(), request_info.request_protocol},
-         {serviceAuthenticationPolicyKey(),
-          ::Wasm::Common::AuthenticationPolicyString(
-              request_info.service_auth_policy)},
-         {destinationServiceNameKey(), request_info.destination_service_name},
-         {destinationServiceNamespaceKey(),
-          flatbuffers::GetString(peer_node_info.namespace_())},
-         {destinationPortKey(), std::to_string(request_info.destination_port)},
-         {responseCodeKey(), std::to_string(request_info.response_code)},
-         {sourcePrincipalKey(), request_info.source_principal},
-         {sourceWorkloadNameKey(),
-          flatbuffers::GetString(local_node_info.workload_name())},
-         {sourceWorkloadNamespaceKey(),
-          flatbuffers::GetString(local_node_info.namespace_())},
-         {sourceOwnerKey(), flatbuffers::GetString(local_node_info.owner())},
-         {destinationPrincipalKey(), request_info.destination_principal},
-         {destinationWorkloadNameKey(),
-          flatbuffers::GetString(peer_node_info.workload_name())},
-         {destinationWorkloadNamespaceKey(),
-          flatbuffers::GetString(peer_node_info.namespace_())},
-         {destinationOwnerKey(),
-          flatbuffers::GetString(peer_node_info.owner())},
-         {destinationCanonicalServiceNameKey(),
-          flatbuffers::GetString(peer_canonical_name)},
-         {destinationCanonicalServiceNamespaceKey(),
-          flatbuffers::GetString(peer_node_info.namespace_())},
-         {destinationCanonicalRevisionKey(),
-          peer_canonical_rev ? peer_canonical_rev->str() : kLatest},
-         {sourceCanonicalServiceNameKey(),
-          flatbuffers::GetString(local_canonical_name)},
-         {sourceCanonicalServiceNamespaceKey(),
-          flatbuffers::GetString(local_node_info.namespace_())},
-         {sourceCanonicalRevisionKey(),
-          local_canonical_rev ? local_canonical_rev->str() : kLatest}});
+        tags);
     return;
   }
-
   opencensus::stats::Record(
-      {{serverRequestCountMeasure(), 1},
-       {serverRequestBytesMeasure(), request_info.request_size},
-       {serverResponseBytesMeasure(), request_info.response_size},
+      {{serverRequestBytesMeasure(), request_info.request_size()},
+       {serverResponseBytesMeasure(), request_info.response_size()},
        {serverResponseLatenciesMeasure(), latency_ms}},
-      {{meshUIDKey(), flatbuffers::GetString(local_node_info.mesh_id())},
-       {requestOperationKey(), operation},
-       {requestProtocolKey(), request_info.request_protocol},
-       {serviceAuthenticationPolicyKey(),
-        ::Wasm::Common::AuthenticationPolicyString(
-            request_info.service_auth_policy)},
-       {destinationServiceNameKey(), request_info.destination_service_name},
-       {destinationServiceNamespaceKey(),
-        flatbuffers::GetString(local_node_info.namespace_())},
-       {destinationPortKey(), std::to_string(request_info.destination_port)},
-       {responseCodeKey(), std::to_string(request_info.response_code)},
-       {sourcePrincipalKey(), request_info.source_principal},
-       {sourceWorkloadNameKey(),
-        flatbuffers::GetString(peer_node_info.workload_name())},
-       {sourceWorkloadNamespaceKey(),
-        flatbuffers::GetString(peer_node_info.namespace_())},
-       {sourceOwnerKey(), flatbuffers::GetString(peer_node_info.owner())},
-       {destinationPrincipalKey(), request_info.destination_principal},
-       {destinationWorkloadNameKey(),
-        flatbuffers::GetString(local_node_info.workload_name())},
-       {destinationWorkloadNamespaceKey(),
-        flatbuffers::GetString(local_node_info.namespace_())},
-       {destinationOwnerKey(), flatbuffers::GetString(local_node_info.owner())},
-       {destinationCanonicalServiceNameKey(),
-        flatbuffers::GetString(local_canonical_name)},
-       {destinationCanonicalServiceNamespaceKey(),
-        flatbuffers::GetString(local_node_info.namespace_())},
-       {destinationCanonicalRevisionKey(),
-        local_canonical_rev ? local_canonical_rev->str() : kLatest},
-       {sourceCanonicalServiceNameKey(),
-        flatbuffers::GetString(peer_canonical_name)},
-       {sourceCanonicalServiceNamespaceKey(),
-        flatbuffers::GetString(peer_node_info.namespace_())},
-       {sourceCanonicalRevisionKey(),
-        peer_canonical_rev ? peer_canonical_rev->str() : kLatest}});
+      tags);
+}
+
+}  // namespace
+
+void Recorder::record(bool is_outbound,
+                      const ::Wasm::Common::FlatNode& local_node_info,
+                      const ::Wasm::Common::FlatNode& peer_node_info,
+                      const std::string& peer_id,
+                      const ::Wasm::Common::RequestInfo& request_info) {
+  std::string key = tagsKey(is_outbound, peer_id, request_info);
+  auto iter = cache_.find(key);
+  if (iter == cache_.end()) {
+    opencensus::tags::TagMap tags(tagValues(is_outbound, local_node_info,
+                                            peer_node_info, request_info));
+    if (cache_.size() >= kMaxCachedTagMaps) {
+      recordCount(is_outbound, 1, tags);
+      recordSizes(is_outbound, request_info, tags);
+      return;
+    }
+    iter = cache_
+               .emplace(std::move(key),
+                        CachedTags{is_outbound, std::move(tags), 0})
+               .first;
+  }
+  iter->second.pending_count++;
+  recordSizes(is_outbound, request_info, iter->second.tags);
+}
+
+void Recorder::flush() {
+  for (auto iter = cache_.begin(); iter != cache_.end();) {
+    auto& cached = iter->second;
+    if (cached.pending_count == 0) {
+      iter = cache_.erase(iter);
+      continue;
+    }
+    recordCount(cached.is_outbound, cached.pending_count, cached.tags);
+    cached.pending_count = 0;
+    ++iter;
+  }
+}
+
+void Recorder::clear() {
+  flush();
+  cache_.clear();
 }
 
 }  // namespace Metric
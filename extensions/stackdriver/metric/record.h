@@ -15,18 +15,60 @@
 
 #pragma once
 
+#include <string>
+#include <unordered_map>
+
 #include "extensions/common/context.h"
 #include "extensions/stackdriver/config/v1alpha1/stackdriver_plugin_config.pb.h"
+#include "opencensus/tags/tag_map.h"
 
 namespace Extensions {
 namespace Stackdriver {
 namespace Metric {
 
-// Record metrics based on local node info and request info.
+// Maximum number of tag maps kept by a Recorder between flushes. Requests
+// with new tags are recorded without caching once it is reached.
+constexpr size_t kMaxCachedTagMaps = 1000;
+
+// Recorder records metrics based on local node info and request info.
 // Reporter kind deceides the type of metrics to record.
-void record(bool is_outbound, const ::Wasm::Common::FlatNode& local_node_info,
-            const ::Wasm::Common::FlatNode& peer_node_info,
-            const ::Wasm::Common::RequestInfo& request_info);
+//
+// Requests with the same tags share a cached OpenCensus tag map, so the tag
+// values are only copied out of the node and request info once. Request counts
+// are also summed per tag map, and only recorded when the recorder is flushed.
+// Byte sizes and latencies are recorded per request, since OpenCensus
+// distributions cannot take pre-aggregated samples. The recorder is flushed
+// several times per export interval, so that the counts are exported along
+// with the distributions of the same requests.
+class Recorder {
+ public:
+  // Records a request with the given peer. peer_id identifies the peer node,
+  // it is part of the cache key along with the tags read from request info.
+  void record(bool is_outbound, const ::Wasm::Common::FlatNode& local_node_info,
+              const ::Wasm::Common::FlatNode& peer_node_info,
+              const std::string& peer_id,
+              const ::Wasm::Common::RequestInfo& request_info);
+
+  // Records the request counts summed since the last flush. Tag maps not used
+  // since the previous flush are dropped.
+  void flush();
+
+  // Flushes and drops all cached tag maps, e.g. when the local node changes.
+  void clear();
+
+  // Number of tag maps cached.
+  size_t cachedTagMaps() const { return cache_.size(); }
+
+ private:
+  struct CachedTags {
+    bool is_outbound;
+    opencensus::tags::TagMap tags;
+    // Number of requests recorded with the tags since the last flush.
+    int64_t pending_count;
+  };
+
+  std::unordered_map<std::string, CachedTags> cache_;
+};
 
 }  // namespace Metric
 }  // namespace Stackdriver
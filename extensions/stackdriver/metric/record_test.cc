@@ -0,0 +1,219 @@
+/* Copyright 2020 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "extensions/stackdriver/metric/record.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "extensions/stackdriver/common/constants.h"
+#include "extensions/stackdriver/metric/registry.h"
+#include "gtest/gtest.h"
+#include "opencensus/stats/testing/test_utils.h"
+
+namespace Extensions {
+namespace Stackdriver {
+namespace Metric {
+namespace {
+
+using opencensus::stats::Aggregation;
+using opencensus::stats::BucketBoundaries;
+using opencensus::stats::View;
+using opencensus::stats::ViewDescriptor;
+using opencensus::stats::testing::TestUtils;
+
+// Builds a node with the given workload name.
+const ::Wasm::Common::FlatNode& nodeInfo(flatbuffers::FlatBufferBuilder& fbb,
+                                         const std::string& workload_name) {
+  auto workload_name_offset = fbb.CreateString(workload_name);
+  auto namespace_offset = fbb.CreateString("test_namespace");
+  auto mesh_id_offset = fbb.CreateString("test_mesh");
+  ::Wasm::Common::FlatNodeBuilder node(fbb);
+  node.add_workload_name(workload_name_offset);
+  node.add_namespace_(namespace_offset);
+  node.add_mesh_id(mesh_id_offset);
+  fbb.Finish(node.Finish());
+  return *flatbuffers::GetRoot<::Wasm::Common::FlatNode>(
+      fbb.GetBufferPointer());
+}
+
+::Wasm::Common::RequestInfo requestInfo(const std::string& service_name) {
+  ::Wasm::Common::RequestInfo request_info;
+  request_info.set_destination_service_name(service_name);
+  request_info.set_request_operation("GET");
+  request_info.set_request_url_path("/reviews");
+  request_info.set_request_protocol("http");
+  request_info.set_service_auth_policy(
+      ::Wasm::Common::ServiceAuthenticationPolicy::MutualTLS);
+  request_info.set_destination_port(8080);
+  request_info.set_response_code(200);
+  request_info.set_source_principal("spiffe://cluster.local/ns/default/sa/a");
+  request_info.set_destination_principal(
+      "spiffe://cluster.local/ns/default/sa/b");
+  request_info.set_request_size(100);
+  return request_info;
+}
+
+// Views of the server request counts and request sizes, by the tags that
+// vary between the recorded requests.
+ViewDescriptor viewDescriptor(const std::string& name,
+                              const std::string& measure,
+                              const Aggregation& aggregation) {
+  return ViewDescriptor()
+      .set_name(name)
+      .set_measure(measure)
+      .set_aggregation(aggregation)
+      .add_column(destinationServiceNameKey())
+      .add_column(requestOperationKey())
+      .add_column(requestProtocolKey())
+      .add_column(serviceAuthenticationPolicyKey())
+      .add_column(destinationPortKey())
+      .add_column(responseCodeKey())
+      .add_column(sourcePrincipalKey())
+      .add_column(destinationPrincipalKey())
+      .add_column(sourceWorkloadNameKey());
+}
+
+class RecorderTest : public testing::Test {
+ protected:
+  RecorderTest()
+      : count_view_(viewDescriptor("test/request_count",
+                                   Common::kServerRequestCountMeasure,
+                                   Aggregation::Sum())),
+        size_view_(viewDescriptor(
+            "test/request_bytes", Common::kServerRequestBytesMeasure,
+            Aggregation::Distribution(BucketBoundaries::Explicit({})))) {}
+
+  static void SetUpTestSuite() {
+    // Registers the measures recorded.
+    serverRequestCountMeasure();
+    serverRequestBytesMeasure();
+    serverResponseBytesMeasure();
+    serverResponseLatenciesMeasure();
+  }
+
+  void record(const std::string& peer_id,
+              const ::Wasm::Common::RequestInfo& request_info) {
+    flatbuffers::FlatBufferBuilder local_fbb, peer_fbb;
+    recorder_.record(/* is_outbound= */ false, nodeInfo(local_fbb, "local"),
+                     nodeInfo(peer_fbb, peer_id), peer_id, request_info);
+  }
+
+  // Request counts by tag values.
+  std::map<std::vector<std::string>, int64_t> counts() {
+    TestUtils::Flush();
+    const auto data = count_view_.GetData();
+    return {data.int_data().begin(), data.int_data().end()};
+  }
+
+  // Numbers of request sizes recorded by tag values.
+  std::map<std::vector<std::string>, int64_t> sizeCounts() {
+    TestUtils::Flush();
+    std::map<std::vector<std::string>, int64_t> size_counts;
+    for (const auto& row : size_view_.GetData().distribution_data()) {
+      size_counts[row.first] = row.second.count();
+    }
+    return size_counts;
+  }
+
+  Recorder recorder_;
+  View count_view_;
+  View size_view_;
+};
+
+// Test that requests differing in any of their tags are counted separately,
+// with the same tags as their sizes.
+TEST_F(RecorderTest, KeyHasAllTags) {
+  std::vector<::Wasm::Common::RequestInfo> requests(10,
+                                                    requestInfo("reviews"));
+  requests[1].set_destination_service_name("ratings");
+  requests[2].set_request_operation("POST");
+  requests[3].set_request_protocol(::Wasm::Common::kProtocolGRPC);
+  requests[4].set_service_auth_policy(
+      ::Wasm::Common::ServiceAuthenticationPolicy::None);
+  requests[5].set_destination_port(9080);
+  requests[6].set_response_code(503);
+  requests[7].set_source_principal("spiffe://cluster.local/ns/default/sa/c");
+  requests[8].set_destination_principal(
+      "spiffe://cluster.local/ns/default/sa/d");
+  for (const auto& request : requests) {
+    record("productpage", request);
+  }
+  record("details", requests[0]);
+  recorder_.flush();
+
+  const auto request_counts = counts();
+  EXPECT_EQ(request_counts.size(), 10u);
+  EXPECT_EQ(request_counts, sizeCounts());
+  // The first and last requests have the same tags.
+  EXPECT_EQ(recorder_.cachedTagMaps(), 10u);
+}
+
+// Test that counts are only recorded on flush, and that tag maps unused since
+// the previous flush are dropped.
+TEST_F(RecorderTest, FlushEvictsUnusedTagMaps) {
+  record("productpage", requestInfo("reviews"));
+  record("productpage", requestInfo("reviews"));
+  record("productpage", requestInfo("ratings"));
+  EXPECT_TRUE(counts().empty());
+  EXPECT_EQ(recorder_.cachedTagMaps(), 2u);
+
+  recorder_.flush();
+  EXPECT_EQ(counts(), sizeCounts());
+  EXPECT_EQ(recorder_.cachedTagMaps(), 2u);
+
+  record("productpage", requestInfo("reviews"));
+  recorder_.flush();
+  EXPECT_EQ(recorder_.cachedTagMaps(), 1u);
+  recorder_.flush();
+  EXPECT_EQ(recorder_.cachedTagMaps(), 0u);
+  EXPECT_EQ(counts(), sizeCounts());
+}
+
+// Test that requests with new tags are counted right away once the cache is
+// full.
+TEST_F(RecorderTest, FullCacheRecordsUncached) {
+  for (size_t i = 0; i < kMaxCachedTagMaps; i++) {
+    record("productpage", requestInfo("reviews-" + std::to_string(i)));
+  }
+  EXPECT_TRUE(counts().empty());
+
+  record("productpage", requestInfo("ratings"));
+  EXPECT_EQ(recorder_.cachedTagMaps(), kMaxCachedTagMaps);
+  const auto request_counts = counts();
+  ASSERT_EQ(request_counts.size(), 1u);
+  EXPECT_EQ(request_counts.begin()->first[0], "ratings");
+  EXPECT_EQ(request_counts.begin()->second, 1);
+
+  recorder_.flush();
+  EXPECT_EQ(counts().size(), kMaxCachedTagMaps + 1);
+  EXPECT_EQ(counts(), sizeCounts());
+}
+
+// Test that clear records the pending counts and drops all tag maps.
+TEST_F(RecorderTest, Clear) {
+  record("productpage", requestInfo("reviews"));
+  record("details", requestInfo("reviews"));
+  recorder_.clear();
+  EXPECT_EQ(recorder_.cachedTagMaps(), 0u);
+  EXPECT_EQ(counts().size(), 2u);
+  EXPECT_EQ(counts(), sizeCounts());
+}
+
+}  // namespace
+}  // namespace Metric
+}  // namespace Stackdriver
+}  // namespace Extensions
@@ -17,10 +17,12 @@
 
 #include <google/protobuf/util/json_util.h>
 
+#include <algorithm>
 #include <random>
 #include <string>
 #include <unordered_map>
 
+#include "extensions/stackdriver/common/utils.h"
 #include "extensions/stackdriver/edges/mesh_edges_service_client.h"
 #include "extensions/stackdriver/log/exporter.h"
 #include "extensions/stackdriver/metric/registry.h"
@@ -48,7 +50,9 @@ using Envoy::Extensions::Common::Wasm::Null::Plugin::getValue;
 using ::Extensions::Stackdriver::Edges::EdgeReporter;
 using Extensions::Stackdriver::Edges::MeshEdgesServiceClientImpl;
 using Extensions::Stackdriver::Log::ExporterImpl;
+using Extensions::Stackdriver::Log::ExportQueueOption;
 using ::Extensions::Stackdriver::Log::Logger;
+using ::Extensions::Stackdriver::Log::Sampler;
 using stackdriver::config::v1alpha1::PluginConfig;
 using ::Wasm::Common::kDownstreamMetadataIdKey;
 using ::Wasm::Common::kDownstreamMetadataKey;
@@ -59,6 +63,9 @@ using ::Wasm::Common::RequestInfo;
 constexpr char kStackdriverExporter[] = "stackdriver_exporter";
 constexpr char kExporterRegistered[] = "registered";
 constexpr int kDefaultLogExportMilliseconds = 10000;  // 10s
+// Pre-aggregated request counts are flushed this many times per metric export
+// interval, so that they are at most a fraction of an interval late.
+constexpr int kMetricFlushesPerExportInterval = 10;
 
 namespace {
 
@@ -138,11 +145,14 @@ std::string getMonitoringEndpoint() {
 
 bool StackdriverRootContext::onConfigure(size_t) {
   // onStart is called prior to onConfigure
-  if (enableServerAccessLog() || enableEdgeReporting()) {
-    proxy_set_tick_period_milliseconds(kDefaultLogExportMilliseconds);
-  } else {
-    proxy_set_tick_period_milliseconds(0);
-  }
+  // The tick is always needed to flush the pre-aggregated request counts, and
+  // log entries are exported every few ticks when it is shorter than the log
+  // export period.
+  const int tick_milliseconds = getTickPeriodMilliseconds(
+      getExportInterval() * 1000, kDefaultLogExportMilliseconds,
+      kMetricFlushesPerExportInterval);
+  log_export_ticks_ = kDefaultLogExportMilliseconds / tick_milliseconds;
+  proxy_set_tick_period_milliseconds(tick_milliseconds);
 
   WasmDataPtr configuration = getConfiguration();
   // TODO: add config validation to reject the listener if project id is not in
@@ -162,8 +172,11 @@ bool StackdriverRootContext::onConfigure(size_t) {
     return false;
   }
 
+  // Cached metric tags depend on the local node and the direction.
+  metric_recorder_.clear();
   direction_ = ::Wasm::Common::getTrafficDirection();
   use_host_header_fallback_ = !config_.disable_host_header_fallback();
+  share_request_info_ = config_.share_request_info();
   const ::Wasm::Common::FlatNode& local_node =
       *flatbuffers::GetRoot<::Wasm::Common::FlatNode>(local_node_info_.data());
 
@@ -188,11 +201,27 @@ bool StackdriverRootContext::onConfigure(size_t) {
     // recreate logger because of config update.
     auto logging_stub_option = stub_option;
     logging_stub_option.default_endpoint = kLoggingService;
-    auto exporter = std::make_unique<ExporterImpl>(this, logging_stub_option);
+    ExportQueueOption queue_option;
+    if (config_.max_log_export_calls() > 0) {
+      queue_option.max_export_calls = config_.max_log_export_calls();
+    }
+    if (config_.max_log_export_queue_bytes() > 0) {
+      queue_option.max_queue_bytes = config_.max_log_export_queue_bytes();
+    }
+    queue_option.overflow_policy = config_.log_export_overflow_policy();
+    auto exporter = std::make_unique<ExporterImpl>(this, logging_stub_option,
+                                                   queue_option);
     // logger takes ownership of exporter.
     logger_ = std::make_unique<Logger>(local_node, std::move(exporter));
   }
 
+  if (config_.max_access_log_entries_per_second() > 0) {
+    log_sampler_ =
+        std::make_unique<Sampler>(config_.max_access_log_entries_per_second());
+  } else {
+    log_sampler_.reset();
+  }
+
   if (!edge_reporter_ && enableEdgeReporting()) {
     // edge reporter should only be initiated once, for now there is no reason
     // to recreate edge reporter because of config update.
@@ -250,7 +279,10 @@ bool StackdriverRootContext::onConfigure(size_t) {
 bool StackdriverRootContext::onStart(size_t) { return true; }
 
 void StackdriverRootContext::onTick() {
-  if (enableServerAccessLog()) {
+  metric_recorder_.flush();
+  if (enableServerAccessLog() &&
+      ++ticks_since_log_export_ >= log_export_ticks_) {
+    ticks_since_log_export_ = 0;
     logger_->exportLogEntry(/* is_on_done= */ false);
   }
   if (enableEdgeReporting()) {
@@ -272,6 +304,7 @@ void StackdriverRootContext::onTick() {
 
 bool StackdriverRootContext::onDone() {
   bool done = true;
+  metric_recorder_.flush();
   // Check if logger is empty. In base Wasm VM, only onStart and onDone are
   // called, but onConfigure is not triggered. onConfigure is only triggered in
   // thread local VM, which makes it possible that logger_ is empty ptr even
@@ -303,22 +336,42 @@ void StackdriverRootContext::record() {
   ::Wasm::Common::populateHTTPRequestInfo(
       isOutbound(), useHostHeaderFallback(), &request_info,
       flatbuffers::GetString(destination_node_info.namespace_()));
-  ::Extensions::Stackdriver::Metric::record(isOutbound(), local_node, peer_node,
-                                            request_info);
+  if (share_request_info_) {
+    ::Wasm::Common::loadSharedHTTPRequestInfo(&request_info);
+  }
+  std::string peer_id;
+  if (!getValue({"filter_state",
+                 outbound ? ::Wasm::Common::kUpstreamMetadataIdKey
+                          : ::Wasm::Common::kDownstreamMetadataIdKey},
+                &peer_id)) {
+    // Peers without an ID are told apart by their metadata.
+    peer_id = peer;
+  }
+  metric_recorder_.record(outbound, local_node, peer_node, peer_id,
+                          request_info);
   if (enableServerAccessLog() && shouldLogThisRequest()) {
-    ::Wasm::Common::populateExtendedHTTPRequestInfo(&request_info);
-    logger_->addLogEntry(request_info, peer_node);
+    const double sample_rate =
+        log_sampler_ ? log_sampler_->sample(peer_node, request_info,
+                                            getCurrentTimeNanoseconds())
+                     : 1.0;
+    if (sample_rate > 0) {
+      // The extended fields used by the log entry are read on access.
+      logger_->addLogEntry(request_info, peer_node, sample_rate);
+    }
   }
   if (enableEdgeReporting()) {
-    std::string peer_id;
-    if (!getValue({"filter_state", ::Wasm::Common::kDownstreamMetadataIdKey},
-                  &peer_id)) {
+    std::string downstream_peer_id;
+    if (getValue({"filter_state", ::Wasm::Common::kDownstreamMetadataIdKey},
+                 &downstream_peer_id)) {
+      edge_reporter_->addEdge(request_info, downstream_peer_id, peer_node);
+    } else {
       LOG_DEBUG(absl::StrCat(
           "cannot get metadata for: ", ::Wasm::Common::kDownstreamMetadataIdKey,
           "; skipping edge."));
-      return;
     }
-    edge_reporter_->addEdge(request_info, peer_id, peer_node);
+  }
+  if (share_request_info_) {
+    ::Wasm::Common::shareHTTPRequestInfo(request_info);
   }
 }
 
@@ -20,6 +20,7 @@
 #include "extensions/stackdriver/config/v1alpha1/stackdriver_plugin_config.pb.h"
 #include "extensions/stackdriver/edges/edge_reporter.h"
 #include "extensions/stackdriver/log/logger.h"
+#include "extensions/stackdriver/log/sampler.h"
 #include "extensions/stackdriver/metric/record.h"
 
 // OpenCensus is full of unused parameters in metric_service.
@@ -97,9 +98,21 @@ class StackdriverRootContext : public RootContext {
   ::Wasm::Common::TrafficDirection direction_{
       ::Wasm::Common::TrafficDirection::Unspecified};
 
+  // Recorder caches metric tags and pre-aggregates request counts, which are
+  // flushed on tick.
+  ::Extensions::Stackdriver::Metric::Recorder metric_recorder_;
+
+  // Ticks between log entry exports, and since the last one.
+  int log_export_ticks_ = 1;
+  int ticks_since_log_export_ = 0;
+
   // Logger records and exports log entries to Stackdriver backend.
   std::unique_ptr<::Extensions::Stackdriver::Log::Logger> logger_;
 
+  // Sampler limits the rate of access log entries. Null if every request is
+  // logged.
+  std::unique_ptr<::Extensions::Stackdriver::Log::Sampler> log_sampler_;
+
   std::unique_ptr<::Extensions::Stackdriver::Edges::EdgeReporter>
       edge_reporter_;
 
@@ -114,6 +127,9 @@ class StackdriverRootContext : public RootContext {
       kDefaultEdgeEpochReportDurationNanoseconds;
 
   bool use_host_header_fallback_;
+  // Set if the request attributes are shared with the other plugins of the
+  // stream.
+  bool share_request_info_ = false;
 };
 
 // StackdriverContext is per stream context. It has the same lifetime as
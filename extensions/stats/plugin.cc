@@ -16,6 +16,7 @@
 #include "extensions/stats/plugin.h"
 
 #include "absl/strings/ascii.h"
+#include "absl/strings/str_split.h"
 #include "extensions/common/util.h"
 #include "google/protobuf/util/time_util.h"
 
@@ -46,14 +47,24 @@ namespace Plugin {
 namespace Stats {
 
 constexpr long long kDefaultTCPReportDurationMilliseconds = 15000;  // 15s
+// Periodic TCP reports are spread over the reporting interval with a timer
+// wheel of at most this many slots, each at least the given duration.
+constexpr long long kTCPReportWheelSlots = 16;
+constexpr long long kMinTCPReportSlotMilliseconds = 100;
+// Lower bound on the number of TCP reports issued per tick.
+constexpr size_t kMinTCPReportsPerTick = 100;
+constexpr int32_t kDefaultPeerCacheSize = 500;
+constexpr int32_t kDefaultMetricCacheSize = 10000;
+// Bound on the symbol table size relative to the metric cache size.
+constexpr size_t kMaxSymbolsPerCacheEntry = 4;
 
 namespace {
 
-// Efficient way to assign flatbuffer to a vector of strings.
-// After C++17 could be simplified to a basic assignment.
-#define FB_ASSIGN(name, v) \
-  instance[name].assign((v) ? (v)->c_str() : nullptr, (v) ? (v)->size() : 0);
-void map_node(IstioDimensions& instance, bool is_source,
+// Efficient way to intern a flatbuffer string into the dimensions.
+#define FB_ASSIGN(name, v)         \
+  instance[name] = symbols.intern( \
+      (v) ? StringView((v)->c_str(), (v)->size()) : StringView());
+void map_node(SymbolTable& symbols, IstioDimensions& instance, bool is_source,
               const ::Wasm::Common::FlatNode& node) {
   // Ensure all properties are set (and cleared when necessary).
   if (is_source) {
@@ -81,13 +92,13 @@ void map_node(IstioDimensions& instance, bool is_source,
       if (rev) {
         FB_ASSIGN(source_canonical_revision, rev->value());
       } else {
-        instance[source_canonical_revision] = "latest";
+        instance[source_canonical_revision] = symbols.intern("latest");
       }
     } else {
-      instance[source_app] = "";
-      instance[source_version] = "";
-      instance[source_canonical_service] = "";
-      instance[source_canonical_revision] = "latest";
+      instance[source_app] = kEmptySymbol;
+      instance[source_version] = kEmptySymbol;
+      instance[source_canonical_service] = kEmptySymbol;
+      instance[source_canonical_revision] = symbols.intern("latest");
     }
   } else {
     FB_ASSIGN(destination_workload, node.workload_name());
@@ -114,13 +125,13 @@ void map_node(IstioDimensions& instance, bool is_source,
       if (rev) {
         FB_ASSIGN(destination_canonical_revision, rev->value());
       } else {
-        instance[destination_canonical_revision] = "latest";
+        instance[destination_canonical_revision] = symbols.intern("latest");
       }
     } else {
-      instance[destination_app] = "";
-      instance[destination_version] = "";
-      instance[destination_canonical_service] = "";
-      instance[destination_canonical_revision] = "latest";
+      instance[destination_app] = kEmptySymbol;
+      instance[destination_version] = kEmptySymbol;
+      instance[destination_canonical_service] = kEmptySymbol;
+      instance[destination_canonical_revision] = symbols.intern("latest");
     }
 
     FB_ASSIGN(destination_service_namespace, node.namespace_());
@@ -129,15 +140,15 @@ void map_node(IstioDimensions& instance, bool is_source,
 #undef FB_ASSIGN
 
 // Called during request processing.
-void map_peer(IstioDimensions& instance, bool outbound,
+void map_peer(SymbolTable& symbols, IstioDimensions& instance, bool outbound,
               const ::Wasm::Common::FlatNode& peer_node) {
-  map_node(instance, !outbound, peer_node);
+  map_node(symbols, instance, !outbound, peer_node);
 }
 
 void map_unknown_if_empty(IstioDimensions& instance) {
-#define SET_IF_EMPTY(name)      \
-  if (instance[name].empty()) { \
-    instance[name] = unknown;   \
+#define SET_IF_EMPTY(name)              \
+  if (instance[name] == kEmptySymbol) { \
+    instance[name] = kUnknownSymbol;    \
   }
   STD_ISTIO_DIMENSIONS(SET_IF_EMPTY)
 #undef SET_IF_EMPTY
@@ -145,31 +156,152 @@ void map_unknown_if_empty(IstioDimensions& instance) {
 
 // maps from request context to dimensions.
 // local node derived dimensions are already filled in.
-void map_request(IstioDimensions& instance,
+void map_request(SymbolTable& symbols, IstioDimensions& instance,
                  const ::Wasm::Common::RequestInfo& request) {
-  instance[source_principal] = request.source_principal;
-  instance[destination_principal] = request.destination_principal;
-  instance[destination_service] = request.destination_service_host;
-  instance[destination_service_name] = request.destination_service_name;
-  instance[request_protocol] = request.request_protocol;
-  instance[response_code] = std::to_string(request.response_code);
-  instance[response_flags] = request.response_flag;
-  instance[connection_security_policy] = absl::AsciiStrToLower(std::string(
-      ::Wasm::Common::AuthenticationPolicyString(request.service_auth_policy)));
-}
-
-// maps peer_node and request to dimensions.
-void map(IstioDimensions& instance, bool outbound,
-         const ::Wasm::Common::FlatNode& peer_node,
+  instance[source_principal] = symbols.intern(request.source_principal());
+  instance[destination_principal] =
+      symbols.intern(request.destination_principal());
+  instance[destination_service] =
+      symbols.intern(request.destination_service_host());
+  instance[destination_service_name] =
+      symbols.intern(request.destination_service_name());
+  instance[request_protocol] = symbols.intern(request.request_protocol());
+  instance[response_code] =
+      symbols.intern(std::to_string(request.response_code()));
+  instance[response_flags] = symbols.intern(request.response_flag());
+  instance[connection_security_policy] =
+      symbols.intern(absl::AsciiStrToLower(
+          std::string(::Wasm::Common::AuthenticationPolicyString(
+              request.service_auth_policy()))));
+}
+
+// Dimensions derived from the peer node. The peer is the destination for
+// outbound traffic and the source for inbound traffic.
+const std::vector<size_t>& peerDimensionIndexes(bool outbound) {
+  static const std::vector<size_t> destination_indexes = {
+      destination_workload,           destination_workload_namespace,
+      destination_app,                destination_version,
+      destination_canonical_service,  destination_canonical_revision,
+      destination_service_namespace};
+  static const std::vector<size_t> source_indexes = {
+      source_workload,          source_workload_namespace,
+      source_app,               source_version,
+      source_canonical_service, source_canonical_revision};
+  return outbound ? destination_indexes : source_indexes;
+}
+
+// maps request and the already mapped peer dimensions to dimensions.
+void map(SymbolTable& symbols, IstioDimensions& instance,
          const ::Wasm::Common::RequestInfo& request) {
-  map_peer(instance, outbound, peer_node);
-  map_request(instance, request);
+  map_request(symbols, instance, request);
   map_unknown_if_empty(instance);
-  if (request.request_protocol == "grpc") {
-    instance[grpc_response_status] = std::to_string(request.grpc_status);
+  if (request.request_protocol() == "grpc") {
+    instance[grpc_response_status] =
+        symbols.intern(std::to_string(request.grpc_status()));
   } else {
-    instance[grpc_response_status] = "";
+    instance[grpc_response_status] = kEmptySymbol;
+  }
+}
+
+// String attributes that can be read directly.
+const std::vector<std::vector<std::string>>& stringAttributes() {
+  static const std::vector<std::vector<std::string>> attributes = {
+      {"request", "path"},
+      {"request", "url_path"},
+      {"request", "host"},
+      {"request", "scheme"},
+      {"request", "method"},
+      {"request", "protocol"},
+      {"request", "id"},
+      {"request", "referer"},
+      {"request", "useragent"},
+      {"response", "code_details"},
+      {"source", "address"},
+      {"destination", "address"},
+      {"connection", "requested_server_name"},
+      {"connection", "tls_version"},
+      {"connection", "subject_local_certificate"},
+      {"connection", "subject_peer_certificate"},
+      {"connection", "uri_san_local_certificate"},
+      {"connection", "uri_san_peer_certificate"},
+      {"upstream", "address"},
+      {"upstream", "local_address"},
+  };
+  return attributes;
+}
+
+// String fields of the peer node that can be read directly.
+const std::vector<std::string>& peerFields() {
+  static const std::vector<std::string> fields = {
+      "name",          "namespace", "owner", "workload_name",
+      "istio_version", "mesh_id"};
+  return fields;
+}
+
+const flatbuffers::String* peerField(const ::Wasm::Common::FlatNode& node,
+                                     const std::string& field) {
+  if (field == "name") {
+    return node.name();
+  } else if (field == "namespace") {
+    return node.namespace_();
+  } else if (field == "owner") {
+    return node.owner();
+  } else if (field == "workload_name") {
+    return node.workload_name();
+  } else if (field == "istio_version") {
+    return node.istio_version();
+  } else if (field == "mesh_id") {
+    return node.mesh_id();
+  }
+  return nullptr;
+}
+
+bool isIdentifier(StringView input) {
+  if (input.empty() || absl::ascii_isdigit(input[0])) {
+    return false;
+  }
+  for (char c : input) {
+    if (!absl::ascii_isalnum(c) && c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Parses a single or double quoted map key in brackets, e.g. ['x'].
+bool consumeMapKey(StringView& input, std::string* key) {
+  if (input.size() < 4 || input.front() != '[' || input.back() != ']') {
+    return false;
+  }
+  const char quote = input[1];
+  if ((quote != '\'' && quote != '"') || input[input.size() - 2] != quote) {
+    return false;
+  }
+  StringView value = input.substr(2, input.size() - 4);
+  if (value.find_first_of("'\"\\") != StringView::npos) {
+    return false;
+  }
+  key->assign(value.data(), value.size());
+  input = StringView();
+  return true;
+}
+
+// Reads a string attribute path as compiled by compileExpression.
+bool getStringAttribute(const std::vector<std::string>& path,
+                        std::string* value) {
+  if (path.size() == 2) {
+    return getValue({path[0], path[1]}, value);
   }
+  return getValue({path[0], path[1], path[2]}, value);
+}
+
+// Number of ticks closest to the period, at least one.
+uint64_t ticksPerPeriod(long long period_milis, long long tick_period_milis) {
+  if (tick_period_milis <= 0) {
+    return 1;
+  }
+  return std::max<long long>(
+      1, (period_milis + tick_period_milis / 2) / tick_period_milis);
 }
 
 void clearTcpMetrics(::Wasm::Common::RequestInfo& request_info) {
@@ -180,6 +312,67 @@ void clearTcpMetrics(::Wasm::Common::RequestInfo& request_info) {
 
 }  // namespace
 
+Optional<SimpleExpression> compileExpression(StringView input) {
+  input = absl::StripAsciiWhitespace(input);
+  // Split the leading select chain from an optional map index.
+  const size_t bracket = input.find('[');
+  StringView rest =
+      bracket == StringView::npos ? StringView() : input.substr(bracket);
+  std::vector<std::string> path = absl::StrSplit(input.substr(0, bracket), '.');
+  for (const auto& segment : path) {
+    if (!isIdentifier(segment)) {
+      return {};
+    }
+  }
+  if (path.size() != 2) {
+    return {};
+  }
+
+  SimpleExpression result;
+  if (path[0] == "upstream_peer" || path[0] == "downstream_peer") {
+    result.peer = path[0];
+    if (path[1] == "labels") {
+      std::string key;
+      if (!consumeMapKey(rest, &key)) {
+        return {};
+      }
+      result.kind = SimpleExpression::Kind::PeerLabel;
+      result.path = {key};
+      return result;
+    }
+    const auto& fields = peerFields();
+    if (!rest.empty() ||
+        std::find(fields.begin(), fields.end(), path[1]) == fields.end()) {
+      return {};
+    }
+    result.kind = SimpleExpression::Kind::PeerField;
+    result.path = {path[1]};
+    return result;
+  }
+
+  result.kind = SimpleExpression::Kind::Attribute;
+  if (path[1] == "headers" &&
+      (path[0] == "request" || path[0] == "response")) {
+    std::string key;
+    if (!consumeMapKey(rest, &key)) {
+      return {};
+    }
+    path.push_back(key);
+    result.path = std::move(path);
+    return result;
+  }
+  if (!rest.empty()) {
+    return {};
+  }
+  const auto& attributes = stringAttributes();
+  if (std::find(attributes.begin(), attributes.end(), path) ==
+      attributes.end()) {
+    return {};
+  }
+  result.path = std::move(path);
+  return result;
+}
+
 // Ordered dimension list is used by the metrics API.
 const std::vector<MetricTag>& PluginRootContext::defaultTags() {
   static const std::vector<MetricTag> default_tags = {
@@ -201,18 +394,18 @@ const std::vector<MetricFactory>& PluginRootContext::defaultMetrics() {
       MetricFactory{
           "request_duration_milliseconds", MetricType::Histogram,
           [](const ::Wasm::Common::RequestInfo& request_info) -> uint64_t {
-            return request_info.duration /* in nanoseconds */ / 1000000;
+            return request_info.duration() /* in nanoseconds */ / 1000000;
           },
           false},
       MetricFactory{"request_bytes", MetricType::Histogram,
 
                     [](const ::Wasm::Common::RequestInfo& request_info)
-                        -> uint64_t { return request_info.request_size; },
+                        -> uint64_t { return request_info.request_size(); },
                     false},
       MetricFactory{"response_bytes", MetricType::Histogram,
 
                     [](const ::Wasm::Common::RequestInfo& request_info)
-                        -> uint64_t { return request_info.response_size; },
+                        -> uint64_t { return request_info.response_size(); },
                     false},
       // TCP metrics.
       MetricFactory{"tcp_sent_bytes_total", MetricType::Counter,
@@ -332,13 +525,17 @@ void PluginRootContext::initializeDimensions() {
     }
   }
 
-  // Local data does not change, so populate it on config load.
-  istio_dimensions_.resize(count_standard_labels + expressions_.size());
-  istio_dimensions_[reporter] = outbound_ ? source : destination;
+  peer_indexes_ = peerDimensionIndexes(outbound_);
+  for (size_t i = 0; i < expressions_.size(); i++) {
+    const auto& simple = expressions_[i].simple;
+    if (simple.has_value() && !simple->peer.empty()) {
+      peer_indexes_.push_back(count_standard_labels + i);
+    }
+  }
 
-  const auto& local_node =
-      *flatbuffers::GetRoot<::Wasm::Common::FlatNode>(local_node_info_.data());
-  map_node(istio_dimensions_, outbound_, local_node);
+  // Symbols and everything keyed by them are tied to the dimension layout, so
+  // drop them on config load.
+  resetDimensions();
 
   // Instantiate stat factories using the new dimensions
   auto field_separator = CONFIG_DEFAULT(field_separator);
@@ -367,9 +564,13 @@ void PluginRootContext::initializeDimensions() {
       }
     }
     stats_.emplace_back(stat_prefix, factory_it.second, tags, indexes,
-                        field_separator, value_separator);
+                        field_separator, value_separator,
+                        std::max(config_.dimension_cardinality_limit(), 0));
   }
 
+  const auto& local_node =
+      *flatbuffers::GetRoot<::Wasm::Common::FlatNode>(local_node_info_.data());
+
   Metric build(MetricType::Gauge, absl::StrCat(stat_prefix, "build"),
                {MetricTag{"component", MetricTag::TagType::String},
                 MetricTag{"tag", MetricTag::TagType::String}});
@@ -408,6 +609,13 @@ bool PluginRootContext::onConfigure(size_t) {
 
   debug_ = config_.debug();
   use_host_header_fallback_ = !config_.disable_host_header_fallback();
+  share_request_info_ = config_.share_request_info();
+  max_peer_cache_size_ = config_.max_peer_cache_size() == 0
+                             ? kDefaultPeerCacheSize
+                             : config_.max_peer_cache_size();
+  max_metric_cache_size_ = config_.max_metric_cache_size() == 0
+                               ? kDefaultMetricCacheSize
+                               : config_.max_metric_cache_size();
 
   initializeDimensions();
 
@@ -417,14 +625,46 @@ bool PluginRootContext::onConfigure(size_t) {
         ::google::protobuf::util::TimeUtil::DurationToMilliseconds(
             config_.tcp_reporting_duration());
   }
-  proxy_set_tick_period_milliseconds(tcp_report_duration_milis);
+  long long flush_interval_milis = 0;
+  if (config_.has_metrics_flush_interval()) {
+    flush_interval_milis =
+        ::google::protobuf::util::TimeUtil::DurationToMilliseconds(
+            config_.metrics_flush_interval());
+  }
+  if (flush_interval_milis <= 0 && batch_metrics_) {
+    // Batching is turned off, send what has been accumulated so far.
+    batch_.flush();
+  }
+  batch_metrics_ = flush_interval_milis > 0;
+
+  // Spread the open connections over the TCP report wheel.
+  const long long wheel_slots = std::max<long long>(
+      1, std::min(kTCPReportWheelSlots,
+                  tcp_report_duration_milis / kMinTCPReportSlotMilliseconds));
+  const long long slot_milis = tcp_report_duration_milis / wheel_slots;
+  tcp_wheel_.assign(wheel_slots, {});
+  tcp_wheel_hand_ = 0;
+  tcp_report_backlog_.clear();
+  size_t slot = 0;
+  for (const auto& item : tcp_request_queue_) {
+    tcp_wheel_[slot++ % tcp_wheel_.size()].push_back(item.first);
+  }
+
+  tcp_report_duration_milis_ = tcp_report_duration_milis;
+  tcp_slot_milis_ = slot_milis > 0 ? slot_milis : tcp_report_duration_milis;
+  flush_interval_milis_ = flush_interval_milis;
+  tick_count_ = 0;
+  tick_period_milis_ = 0;
+  setTickPeriod(!tcp_request_queue_.empty());
 
   return true;
 }
 
 void PluginRootContext::cleanupExpressions() {
-  for (uint32_t token : expressions_) {
-    exprDelete(token);
+  for (const auto& expression : expressions_) {
+    if (!expression.simple.has_value()) {
+      exprDelete(expression.token);
+    }
   }
   expressions_.clear();
   input_expressions_.clear();
@@ -436,16 +676,30 @@ void PluginRootContext::cleanupExpressions() {
 
 Optional<size_t> PluginRootContext::addStringExpression(
     const std::string& input) {
-  auto it = input_expressions_.find(input);
+  auto simple = compileExpression(input);
+  if (simple.has_value() && !simple->peer.empty() &&
+      simple->peer != (outbound_ ? "upstream_peer" : "downstream_peer")) {
+    // Only the peer node of this proxy's peer is available to the plugin.
+    simple = {};
+  }
+  // Simple lookups are keyed by their compiled form, so that different
+  // spellings of the same lookup share a slot.
+  const std::string key =
+      simple.has_value()
+          ? absl::StrCat(static_cast<int>(simple->kind), ":", simple->peer,
+                         ":", absl::StrJoin(simple->path, "/"))
+          : input;
+  auto it = input_expressions_.find(key);
   if (it == input_expressions_.end()) {
-    uint32_t token = 0;
-    if (createExpression(input, &token) != WasmResult::Ok) {
+    DimensionExpression expression{simple, 0};
+    if (!simple.has_value() &&
+        createExpression(input, &expression.token) != WasmResult::Ok) {
       LOG_WARN(absl::StrCat("Cannot create an expression: " + input));
       return {};
     }
     size_t result = expressions_.size();
-    input_expressions_[input] = result;
-    expressions_.push_back(token);
+    input_expressions_[key] = result;
+    expressions_.push_back(std::move(expression));
     return result;
   }
   return it->second;
@@ -463,53 +717,221 @@ Optional<uint32_t> PluginRootContext::addIntExpression(
 }
 
 bool PluginRootContext::onDone() {
+  batch_.flush();
   cleanupExpressions();
   return true;
 }
 
 void PluginRootContext::onTick() {
-  if (tcp_request_queue_.size() < 1) {
+  tick_count_++;
+  if (tick_count_ % tcp_slot_ticks_ == 0) {
+    advanceTCPWheel();
+  }
+  reportTCP();
+  if (batch_metrics_ && tick_count_ % flush_ticks_ == 0) {
+    batch_.flush();
+  }
+  if (tcp_wheel_active_ && tcp_request_queue_.empty() &&
+      tcp_report_backlog_.empty()) {
+    // All connections are closed, so the slots only hold stale entries.
+    for (auto& slot : tcp_wheel_) {
+      slot.clear();
+    }
+    setTickPeriod(false);
+  }
+}
+
+void PluginRootContext::setTickPeriod(bool tcp_wheel_active) {
+  // The wheel and metric flushes share the timer, so count both in ticks. The
+  // wheel needs a tick per slot only while it holds connections.
+  long long tick_period_milis =
+      tcp_wheel_active ? tcp_slot_milis_ : tcp_report_duration_milis_;
+  if (batch_metrics_) {
+    tick_period_milis = std::min(tick_period_milis, flush_interval_milis_);
+  }
+  // Keep the time elapsed since the last metric flush across the change.
+  if (tick_period_milis_ > 0 && tick_period_milis > 0) {
+    const long long since_flush_milis =
+        (tick_count_ % flush_ticks_) * tick_period_milis_;
+    tick_count_ = (since_flush_milis + tick_period_milis / 2) /
+                  tick_period_milis;
+  }
+  tcp_slot_ticks_ = ticksPerPeriod(tcp_slot_milis_, tick_period_milis);
+  flush_ticks_ = ticksPerPeriod(flush_interval_milis_, tick_period_milis);
+  tcp_wheel_active_ = tcp_wheel_active;
+  if (tick_period_milis != tick_period_milis_) {
+    tick_period_milis_ = tick_period_milis;
+    proxy_set_tick_period_milliseconds(tick_period_milis);
+  }
+}
+
+void PluginRootContext::advanceTCPWheel() {
+  if (tcp_wheel_.empty()) {
+    return;
+  }
+  tcp_wheel_hand_ = (tcp_wheel_hand_ + 1) % tcp_wheel_.size();
+  auto& slot = tcp_wheel_[tcp_wheel_hand_];
+  // Queue the open connections of the slot for a report and drop the closed
+  // ones.
+  size_t open = 0;
+  for (uint32_t id : slot) {
+    if (tcp_request_queue_.find(id) == tcp_request_queue_.end()) {
+      continue;
+    }
+    slot[open++] = id;
+    tcp_report_backlog_.push_back(id);
+  }
+  slot.resize(open);
+}
+
+void PluginRootContext::reportTCP() {
+  if (tcp_report_backlog_.empty()) {
     return;
   }
-  for (auto const& item : tcp_request_queue_) {
+  // Allow twice the even share of a slot per tick so that a burst of
+  // connections in one slot is absorbed over the next few ticks.
+  size_t budget = std::max(kMinTCPReportsPerTick,
+                           2 * tcp_request_queue_.size() / tcp_wheel_.size());
+  while (budget > 0 && !tcp_report_backlog_.empty()) {
+    const uint32_t id = tcp_report_backlog_.front();
+    tcp_report_backlog_.pop_front();
+    auto item = tcp_request_queue_.find(id);
     // requestinfo is null, so continue.
-    if (item.second == nullptr) {
+    if (item == tcp_request_queue_.end() || item->second == nullptr) {
       continue;
     }
-    Context* context = getContext(item.first);
+    Context* context = getContext(id);
     if (context == nullptr) {
       continue;
     }
+    budget--;
     context->setEffectiveContext();
-    if (report(*item.second, true)) {
+    if (report(*item->second, true)) {
       // Clear existing data in TCP metrics, so that we don't double count the
       // metrics.
-      clearTcpMetrics(*item.second);
+      clearTcpMetrics(*item->second);
     }
   }
 }
 
+void PluginRootContext::resetDimensions() {
+  metrics_.clear();
+  metrics_clock_.clear();
+  metrics_clock_hand_ = 0;
+  peer_cache_.clear();
+  symbols_.clear();
+
+  // Local data does not change, so populate it once here.
+  istio_dimensions_.assign(count_standard_labels + expressions_.size(),
+                           kEmptySymbol);
+  istio_dimensions_[reporter] =
+      symbols_.intern(outbound_ ? source : destination);
+
+  const auto& local_node =
+      *flatbuffers::GetRoot<::Wasm::Common::FlatNode>(local_node_info_.data());
+  map_node(symbols_, istio_dimensions_, outbound_, local_node);
+  local_namespace_ = flatbuffers::GetString(local_node.namespace_());
+}
+
+void PluginRootContext::addMetrics(std::vector<SimpleStat>&& stats) {
+  if (max_metric_cache_size_ <= 0 ||
+      metrics_.size() < static_cast<size_t>(max_metric_cache_size_)) {
+    auto it =
+        metrics_
+            .emplace(istio_dimensions_, MetricCacheEntry{std::move(stats)})
+            .first;
+    metrics_clock_.push_back(&*it);
+    return;
+  }
+
+  // CLOCK eviction: sweep the ring, giving referenced entries a second chance,
+  // and replace the first entry not used since the last sweep.
+  while (metrics_clock_[metrics_clock_hand_]->second.referenced) {
+    metrics_clock_[metrics_clock_hand_]->second.referenced = false;
+    metrics_clock_hand_ = (metrics_clock_hand_ + 1) % metrics_clock_.size();
+  }
+  metrics_.erase(metrics_.find(metrics_clock_[metrics_clock_hand_]->first));
+  auto it =
+      metrics_.emplace(istio_dimensions_, MetricCacheEntry{std::move(stats)})
+          .first;
+  metrics_clock_[metrics_clock_hand_] = &*it;
+  metrics_clock_hand_ = (metrics_clock_hand_ + 1) % metrics_clock_.size();
+  incrementMetric(cache_evictions_, 1);
+}
+
+const PeerDimensions* PluginRootContext::mapPeer(
+    const std::string& peer_id, const ::Wasm::Common::FlatNode* peer_node) {
+  const auto& node = peer_node
+                         ? *peer_node
+                         : *flatbuffers::GetRoot<::Wasm::Common::FlatNode>(
+                               empty_node_info_.data());
+  map_peer(symbols_, istio_dimensions_, outbound_, node);
+  for (size_t i = 0; i < expressions_.size(); i++) {
+    const auto& simple = expressions_[i].simple;
+    if (!simple.has_value() || simple->peer.empty()) {
+      continue;
+    }
+    const flatbuffers::String* value = nullptr;
+    if (simple->kind == SimpleExpression::Kind::PeerLabel) {
+      auto labels = node.labels();
+      auto label =
+          labels ? labels->LookupByKey(simple->path[0].c_str()) : nullptr;
+      value = label ? label->value() : nullptr;
+    } else {
+      value = peerField(node, simple->path[0]);
+    }
+    istio_dimensions_[count_standard_labels + i] = symbols_.intern(
+        value ? StringView(value->c_str(), value->size()) : StringView());
+  }
+  if (peer_node == nullptr || max_peer_cache_size_ <= 0 || peer_id.empty() ||
+      peer_id == ::Wasm::Common::kMetadataNotFoundValue) {
+    return nullptr;
+  }
+
+  // The set of peers is expected to be small and stable, so simply start over
+  // once the cache is full.
+  if (peer_cache_.size() >= static_cast<size_t>(max_peer_cache_size_)) {
+    LOG_DEBUG(absl::StrCat("clearing peer cache, size: ", peer_cache_.size()));
+    peer_cache_.clear();
+  }
+  PeerDimensions& peer = peer_cache_[peer_id];
+  for (size_t i : peer_indexes_) {
+    peer.symbols.push_back(istio_dimensions_[i]);
+  }
+  peer.namespace_ = flatbuffers::GetString(peer_node->namespace_());
+  return &peer;
+}
+
 bool PluginRootContext::report(::Wasm::Common::RequestInfo& request_info,
                                bool is_tcp) {
+  // Symbols are never released individually, so start over once the table
+  // outgrows what the metric cache can reference.
+  if (max_metric_cache_size_ > 0 &&
+      symbols_.size() > kMaxSymbolsPerCacheEntry *
+                            static_cast<size_t>(max_metric_cache_size_)) {
+    LOG_DEBUG(absl::StrCat("clearing symbol table, size: ", symbols_.size()));
+    resetDimensions();
+  }
+
   std::string peer_id;
   getValue({"filter_state", peer_metadata_id_key_}, &peer_id);
 
+  // Known peers are mapped from the cache without reading the peer node.
+  const PeerDimensions* cached_peer = nullptr;
+  if (max_peer_cache_size_ > 0 && !peer_id.empty()) {
+    auto peer_it = peer_cache_.find(peer_id);
+    if (peer_it != peer_cache_.end()) {
+      cached_peer = &peer_it->second;
+    }
+  }
+
   std::string peer;
   const ::Wasm::Common::FlatNode* peer_node =
-      getValue({"filter_state", peer_metadata_key_}, &peer)
+      cached_peer == nullptr &&
+              getValue({"filter_state", peer_metadata_key_}, &peer)
           ? flatbuffers::GetRoot<::Wasm::Common::FlatNode>(peer.data())
           : nullptr;
 
-  // map and overwrite previous mapping.
-  const ::Wasm::Common::FlatNode* destination_node_info =
-      outbound_ ? peer_node
-                : flatbuffers::GetRoot<::Wasm::Common::FlatNode>(
-                      local_node_info_.data());
-  std::string destination_namespace =
-      destination_node_info && destination_node_info->namespace_()
-          ? destination_node_info->namespace_()->str()
-          : "";
-
   if (is_tcp) {
     // For TCP, if peer metadata is not available, peer id is set as not found.
     // Otherwise, we wait for metadata exchange to happen before we report  any
@@ -518,11 +940,32 @@ bool PluginRootContext::report(::Wasm::Common::RequestInfo& request_info,
     // been no error in connection.
     uint64_t response_flags = 0;
     getValue({"response", "flags"}, &response_flags);
-    if (peer_node == nullptr &&
+    if (cached_peer == nullptr && peer_node == nullptr &&
         peer_id != ::Wasm::Common::kMetadataNotFoundValue &&
         response_flags == 0) {
       return false;
     }
+  }
+
+  // map and overwrite previous mapping.
+  if (cached_peer != nullptr) {
+    for (size_t i = 0; i < peer_indexes_.size(); i++) {
+      istio_dimensions_[peer_indexes_[i]] = cached_peer->symbols[i];
+    }
+  } else {
+    cached_peer = mapPeer(peer_id, peer_node);
+  }
+
+  std::string destination_namespace;
+  if (!outbound_) {
+    destination_namespace = local_namespace_;
+  } else if (cached_peer != nullptr) {
+    destination_namespace = cached_peer->namespace_;
+  } else if (peer_node != nullptr) {
+    destination_namespace = flatbuffers::GetString(peer_node->namespace_());
+  }
+
+  if (is_tcp) {
     if (!request_info.is_populated) {
       ::Wasm::Common::populateTCPRequestInfo(outbound_, &request_info,
                                              destination_namespace);
@@ -531,26 +974,41 @@ bool PluginRootContext::report(::Wasm::Common::RequestInfo& request_info,
     ::Wasm::Common::populateHTTPRequestInfo(outbound_, useHostHeaderFallback(),
                                             &request_info,
                                             destination_namespace);
+    if (share_request_info_) {
+      ::Wasm::Common::loadSharedHTTPRequestInfo(&request_info);
+    }
   }
 
-  map(istio_dimensions_, outbound_,
-      peer_node ? *peer_node
-                : *flatbuffers::GetRoot<::Wasm::Common::FlatNode>(
-                      empty_node_info_.data()),
-      request_info);
+  map(symbols_, istio_dimensions_, request_info);
+  if (debug_) {
+    LOG_DEBUG(absl::StrCat("request info fields read: ",
+                           request_info.accessedFields()));
+  }
   for (size_t i = 0; i < expressions_.size(); i++) {
-    if (!evaluateExpression(expressions_[i],
-                            &istio_dimensions_.at(count_standard_labels + i))) {
+    const auto& expression = expressions_[i];
+    bool ok;
+    if (!expression.simple.has_value()) {
+      ok = evaluateExpression(expression.token, &expression_value_);
+    } else if (expression.simple->peer.empty()) {
+      ok = getStringAttribute(expression.simple->path, &expression_value_);
+    } else {
+      // Mapped along with the peer.
+      continue;
+    }
+    if (!ok) {
       LOG_TRACE(absl::StrCat("Failed to evaluate expression at slot: " +
                              std::to_string(i)));
-      istio_dimensions_[count_standard_labels + i] = "";
+      expression_value_.clear();
     }
+    istio_dimensions_[count_standard_labels + i] =
+        symbols_.intern(expression_value_);
   }
 
   auto stats_it = metrics_.find(istio_dimensions_);
   if (stats_it != metrics_.end()) {
-    for (auto& stat : stats_it->second) {
-      stat.record(request_info);
+    stats_it->second.referenced = true;
+    for (auto& stat : stats_it->second.stats) {
+      stat.record(request_info, batch_metrics_ ? &batch_ : nullptr);
       LOG_DEBUG(
           absl::StrCat("metricKey cache hit ", ", stat=", stat.metric_id_));
     }
@@ -563,26 +1021,37 @@ bool PluginRootContext::report(::Wasm::Common::RequestInfo& request_info,
   }
 
   std::vector<SimpleStat> stats;
+  uint64_t overflows = 0;
   for (auto& statgen : stats_) {
     if (statgen.is_tcp_metric() != is_tcp) {
       continue;
     }
-    auto stat = statgen.resolve(istio_dimensions_);
+    auto stat = statgen.resolve(istio_dimensions_, symbols_, &overflows);
     LOG_DEBUG(absl::StrCat("metricKey cache miss ", statgen.name(), " ",
                            ", stat=", stat.metric_id_));
-    stat.record(request_info);
+    stat.record(request_info, batch_metrics_ ? &batch_ : nullptr);
     stats.push_back(stat);
   }
 
   incrementMetric(cache_misses_, 1);
-  // TODO: When we have c++17, convert to try_emplace.
-  metrics_.emplace(istio_dimensions_, stats);
+  if (overflows > 0) {
+    incrementMetric(dimension_overflows_, overflows);
+  }
+  addMetrics(std::move(stats));
   return true;
 }
 
 void PluginRootContext::addToTCPRequestQueue(
     uint32_t id, std::shared_ptr<::Wasm::Common::RequestInfo> request_info) {
   tcp_request_queue_[id] = request_info;
+  // The hand reaches the current slot again one interval after the connection
+  // is opened.
+  if (!tcp_wheel_.empty()) {
+    tcp_wheel_[tcp_wheel_hand_].push_back(id);
+  }
+  if (!tcp_wheel_active_) {
+    setTickPeriod(true);
+  }
 }
 
 void PluginRootContext::deleteFromTCPRequestQueue(uint32_t id) {
@@ -15,8 +15,11 @@
 
 #pragma once
 
+#include <deque>
 #include <unordered_map>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_replace.h"
 #include "extensions/common/context.h"
@@ -61,6 +64,7 @@ const std::string unknown = "unknown";
 const std::string source = "source";
 const std::string destination = "destination";
 const std::string vDash = "-";
+const std::string overflow = "overflow";
 
 const std::string default_field_separator = ";.;";
 const std::string default_value_separator = "=.=";
@@ -97,8 +101,53 @@ using google::protobuf::util::Status;
   FIELD_FUNC(response_flags)                 \
   FIELD_FUNC(connection_security_policy)
 
-// Aggregate metric values in a shared and reusable bag.
-using IstioDimensions = std::vector<std::string>;
+// Symbol is an interned dimension value.
+using Symbol = uint32_t;
+
+// Aggregate metric values in a shared and reusable bag. Values are interned in
+// the root context symbol table, so that the bag is a fixed-width key.
+using IstioDimensions = std::vector<Symbol>;
+
+// Symbols reserved for the empty and the "unknown" values.
+constexpr Symbol kEmptySymbol = 0;
+constexpr Symbol kUnknownSymbol = 1;
+
+// SymbolTable maps dimension values to dense symbols and back. Symbols are only
+// meaningful within the table that allocated them.
+class SymbolTable {
+ public:
+  SymbolTable() { clear(); }
+
+  // Returns the symbol for the value, allocating a new one on first use.
+  Symbol intern(StringView value) {
+    auto it = symbols_.find(value);
+    if (it != symbols_.end()) {
+      return it->second;
+    }
+    const Symbol symbol = static_cast<Symbol>(values_.size());
+    values_.emplace_back(value.data(), value.size());
+    symbols_.emplace(values_.back(), symbol);
+    return symbol;
+  }
+
+  inline const std::string& value(Symbol symbol) const {
+    return values_[symbol];
+  }
+  inline size_t size() const { return values_.size(); }
+
+  // Drops all symbols except for the reserved ones.
+  void clear() {
+    symbols_.clear();
+    values_.clear();
+    intern("");
+    intern(unknown);
+  }
+
+ private:
+  // Deque keeps the references stable, so that the map can key on views.
+  std::deque<std::string> values_;
+  absl::flat_hash_map<StringView, Symbol> symbols_;
+};
 
 enum class StandardLabels : int32_t {
 #define DECLARE_LABEL(name) name,
@@ -119,29 +168,131 @@ struct HashIstioDimensions {
   size_t operator()(const IstioDimensions& c) const {
     const size_t kMul = static_cast<size_t>(0x9ddfea08eb382d69);
     size_t h = 0;
-    for (const auto& value : c) {
-      h += std::hash<std::string>()(value) * kMul;
+    for (const auto value : c) {
+      h = (h ^ value) * kMul;
+      h ^= h >> 47;
     }
     return h;
   }
 };
 
+// PeerDimensions holds the dimensions derived from a peer node, so that known
+// peers are mapped without walking the peer node.
+struct PeerDimensions {
+  // Symbols in the order of the peer dimension indexes.
+  std::vector<Symbol> symbols;
+  std::string namespace_;
+};
+
+// SimpleExpression is a custom dimension expression that is a plain attribute
+// or peer node lookup, read directly instead of being evaluated by the host.
+struct SimpleExpression {
+  enum class Kind {
+    // String attribute at path, e.g. request.headers['x'].
+    Attribute,
+    // Peer node label with the key path[0].
+    PeerLabel,
+    // Peer node string field with the name path[0].
+    PeerField,
+  };
+  Kind kind;
+  // Peer the lookup applies to: upstream_peer or downstream_peer.
+  std::string peer;
+  std::vector<std::string> path;
+};
+
+// Returns the simple form of the expression if it has one.
+Optional<SimpleExpression> compileExpression(StringView input);
+
+// DimensionExpression evaluates a custom dimension.
+struct DimensionExpression {
+  // Set if the expression is read directly.
+  Optional<SimpleExpression> simple;
+  // Host expression token otherwise.
+  uint32_t token;
+};
+
 using ValueExtractorFn =
     std::function<uint64_t(const ::Wasm::Common::RequestInfo& request_info)>;
 
+// MetricBatch accumulates counter increments and gauge values between flushes,
+// so that each metric crosses the host boundary once per flush rather than on
+// every request. Histograms are recorded directly since the host only accepts
+// individual samples.
+class MetricBatch {
+ public:
+  // Maximum number of batched metrics before the batch is flushed early.
+  static constexpr size_t kMaxSize = 1000;
+
+  void record(uint32_t metric_id, MetricType type, uint64_t value) {
+    switch (type) {
+      case MetricType::Counter:
+        slot(counters_, metric_id) += value;
+        break;
+      case MetricType::Gauge:
+        slot(gauges_, metric_id) = value;
+        break;
+      default:
+        recordMetric(metric_id, value);
+        break;
+    }
+  }
+
+  // Send the accumulated values to the host. Slots are kept for the next
+  // interval unless the batch is full.
+  void flush() {
+    for (auto& counter : counters_) {
+      if (counter.second > 0) {
+        incrementMetric(counter.first, counter.second);
+        counter.second = 0;
+      }
+    }
+    for (const auto& gauge : gauges_) {
+      recordMetric(gauge.first, gauge.second);
+    }
+    gauges_.clear();
+  }
+
+  size_t size() const { return counters_.size() + gauges_.size(); }
+
+ private:
+  uint64_t& slot(absl::flat_hash_map<uint32_t, uint64_t>& slots,
+                 uint32_t metric_id) {
+    auto it = slots.find(metric_id);
+    if (it != slots.end()) {
+      return it->second;
+    }
+    if (size() >= kMaxSize) {
+      flush();
+      counters_.clear();
+    }
+    return slots[metric_id];
+  }
+
+  absl::flat_hash_map<uint32_t, uint64_t> counters_;
+  absl::flat_hash_map<uint32_t, uint64_t> gauges_;
+};
+
 // SimpleStat record a pre-resolved metric based on the values function.
 class SimpleStat {
  public:
-  SimpleStat(uint32_t metric_id, ValueExtractorFn value_fn)
-      : metric_id_(metric_id), value_fn_(value_fn){};
-
-  inline void record(const ::Wasm::Common::RequestInfo& request_info) {
-    recordMetric(metric_id_, value_fn_(request_info));
+  SimpleStat(uint32_t metric_id, MetricType type, ValueExtractorFn value_fn)
+      : metric_id_(metric_id), type_(type), value_fn_(value_fn){};
+
+  // Record the value into the batch if any, otherwise directly to the host.
+  inline void record(const ::Wasm::Common::RequestInfo& request_info,
+                     MetricBatch* batch) {
+    if (batch != nullptr) {
+      batch->record(metric_id_, type_, value_fn_(request_info));
+    } else {
+      recordMetric(metric_id_, value_fn_(request_info));
+    }
   };
 
   uint32_t metric_id_;
 
  private:
+  MetricType type_;
   ValueExtractorFn value_fn_;
 };
 
@@ -161,16 +312,29 @@ class StatGen {
                    const std::vector<MetricTag>& tags,
                    const std::vector<size_t>& indexes,
                    const std::string& field_separator,
-                   const std::string& value_separator)
+                   const std::string& value_separator,
+                   size_t cardinality_limit = 0)
       : is_tcp_(metric_factory.is_tcp),
         indexes_(indexes),
         extractor_(metric_factory.extractor),
         metric_(metric_factory.type,
                 absl::StrCat(stat_prefix, metric_factory.name), tags,
-                field_separator, value_separator) {
+                field_separator, value_separator),
+        cardinality_limit_(cardinality_limit),
+        tag_values_(tags.size()),
+        folded_values_(tags.size()) {
     if (tags.size() != indexes.size()) {
       logAbort("metric tags.size() != indexes.size()");
     }
+    for (size_t i = 0; i < tags.size(); i++) {
+      // Don't add response_code and grpc_response_status labels for TCP.
+      if (is_tcp_ && (tags[i].name == "response_code" ||
+                      tags[i].name == "grpc_response_status")) {
+        continue;
+      }
+      tag_layout_.push_back(
+          {i, absl::StrCat(tags[i].name, metric_.value_separator)});
+    }
   };
 
   StatGen() = delete;
@@ -179,44 +343,89 @@ class StatGen {
 
   // Resolve metric based on provided dimension values by
   // combining the tags with the indexed dimensions and resolving
-  // to a metric ID.
-  SimpleStat resolve(const IstioDimensions& instance) {
-    // Using a lower level API to avoid creating an intermediary vector
-    size_t s = metric_.prefix.size();
-    for (const auto& tag : metric_.tags) {
-      s += tag.name.size() + metric_.value_separator.size();
-    }
-    for (size_t i : indexes_) {
-      s += instance[i].size() + metric_.field_separator.size();
-    }
-    s += metric_.name.size();
-
-    std::string n;
-    n.reserve(s);
-    n.append(metric_.prefix);
-    for (size_t i = 0; i < metric_.tags.size(); i++) {
-      // Don't add response_code and grpc_response_status labels for TCP.
-      if ((metric_.tags[i].name == "response_code" ||
-           metric_.tags[i].name == "grpc_response_status") &&
-          is_tcp_)
-        continue;
-      n.append(metric_.tags[i].name);
-      n.append(metric_.value_separator);
-      n.append(instance[indexes_[i]]);
+  // to a metric ID. Tag values beyond the cardinality limit are reported as
+  // "overflow" and counted in overflows the first time they are folded.
+  SimpleStat resolve(const IstioDimensions& instance,
+                     const SymbolTable& symbols, uint64_t* overflows) {
+    // Using a lower level API to avoid creating an intermediary vector. The
+    // name buffer is reused across calls, so it stops allocating once it has
+    // grown to the longest name.
+    static thread_local std::string n;
+    n.assign(metric_.prefix);
+    for (const auto& tag : tag_layout_) {
+      n.append(tag.prefix);
+      bool first_fold = false;
+      const auto value =
+          foldValue(tag.position,
+                    symbols.value(instance[indexes_[tag.position]]),
+                    &first_fold);
+      if (first_fold) {
+        (*overflows)++;
+      }
+      n.append(value.data(), value.size());
       n.append(metric_.field_separator);
     }
     n.append(metric_.name);
     auto metric_id = metric_.resolveFullName(n);
-    return SimpleStat(metric_id, extractor_);
+    return SimpleStat(metric_id, metric_.type, extractor_);
   };
 
  private:
+  // Returns the value to report for the tag at the given position. Once a tag
+  // has seen cardinality_limit_ distinct values, new values are folded into
+  // the overflow value. first_fold is set when the value has not been folded
+  // before, so that re-resolving a dimension set after the metric cache is
+  // reset does not count its folded values again.
+  StringView foldValue(size_t tag, const std::string& value,
+                       bool* first_fold) {
+    if (cardinality_limit_ == 0) {
+      return value;
+    }
+    auto& values = tag_values_[tag];
+    if (values.contains(value)) {
+      return value;
+    }
+    if (values.size() < cardinality_limit_) {
+      values.insert(value);
+      return value;
+    }
+    *first_fold =
+        folded_values_[tag].insert(std::hash<std::string>()(value)).second;
+    return overflow;
+  }
+
+  // Tag reported in the metric name.
+  struct TagLayout {
+    // Position in the metric tags.
+    size_t position;
+    // Tag name followed by the value separator.
+    std::string prefix;
+  };
+
   bool is_tcp_;
   std::vector<size_t> indexes_;
+  // Tags in the order they appear in the name, without the tags excluded
+  // for TCP.
+  std::vector<TagLayout> tag_layout_;
   ValueExtractorFn extractor_;
   Metric metric_;
+  size_t cardinality_limit_;
+  // Distinct values reported so far for each tag.
+  std::vector<absl::flat_hash_set<std::string>> tag_values_;
+  // Hashes of the values folded into overflow so far for each tag.
+  std::vector<absl::flat_hash_set<size_t>> folded_values_;
+};
+
+// MetricCacheEntry is the set of metrics resolved for a dimension tuple.
+struct MetricCacheEntry {
+  std::vector<SimpleStat> stats;
+  // CLOCK reference bit, set on every hit.
+  bool referenced = false;
 };
 
+using MetricCache =
+    std::unordered_map<IstioDimensions, MetricCacheEntry, HashIstioDimensions>;
+
 // PluginRootContext is the root context for all streams processed by the
 // thread. It has the same lifetime as the worker thread and acts as target
 // for interactions that outlives individual stream, e.g. timer, async calls.
@@ -229,6 +438,11 @@ class PluginRootContext : public RootContext {
                         MetricTag{"cache", MetricTag::TagType::String}});
     cache_hits_ = cache_count.resolve("stats_filter", "hit");
     cache_misses_ = cache_count.resolve("stats_filter", "miss");
+    cache_evictions_ = cache_count.resolve("stats_filter", "eviction");
+    Metric overflow_count(
+        MetricType::Counter, "metric_dimension_overflow_count",
+        {MetricTag{"wasm_filter", MetricTag::TagType::String}});
+    dimension_overflows_ = overflow_count.resolve("stats_filter");
     ::Wasm::Common::extractEmptyNodeFlatBuffer(&empty_node_info_);
   }
 
@@ -237,12 +451,21 @@ class PluginRootContext : public RootContext {
   bool onConfigure(size_t) override;
   bool onDone() override;
   void onTick() override;
+  // Move the TCP report wheel to the next slot and queue its connections for
+  // a report.
+  void advanceTCPWheel();
+  // Report the metrics of the queued TCP connections, up to a per-tick bound.
+  void reportTCP();
+  // Set the timer to tick once per wheel slot if the wheel is active, or once
+  // per reporting interval otherwise, and at least once per metric flush.
+  void setTickPeriod(bool tcp_wheel_active);
   // Report will return false when peer metadata exchange is not found for TCP,
   // so that we wait to report metrics till we find peer metadata or get
   // information that it's not available.
   bool report(::Wasm::Common::RequestInfo& request_info, bool is_tcp);
   bool outbound() const { return outbound_; }
   bool useHostHeaderFallback() const { return use_host_header_fallback_; };
+  bool shareRequestInfo() const { return share_request_info_; }
   void addToTCPRequestQueue(
       uint32_t id, std::shared_ptr<::Wasm::Common::RequestInfo> request_info);
   void deleteFromTCPRequestQueue(uint32_t id);
@@ -259,17 +482,34 @@ class PluginRootContext : public RootContext {
   Optional<size_t> addStringExpression(const std::string& input);
   // Allocate an int expression and return its token if successful.
   Optional<uint32_t> addIntExpression(const std::string& input);
+  // Map the peer node into the dimensions and memoize the result by the peer
+  // ID. Returns the cached entry if any.
+  const PeerDimensions* mapPeer(const std::string& peer_id,
+                                const ::Wasm::Common::FlatNode* peer_node);
+  // Drop all interned symbols along with the caches keyed by them, and map the
+  // local node into the dimensions again.
+  void resetDimensions();
+  // Cache the metrics resolved for the current dimensions, evicting an entry
+  // if the cache is full.
+  void addMetrics(std::vector<SimpleStat>&& stats);
 
  private:
   stats::PluginConfig config_;
   std::string local_node_info_;
   std::string empty_node_info_;
+  std::string local_namespace_;
 
+  // Interned dimension values. Reset together with the metric cache.
+  SymbolTable symbols_;
   IstioDimensions istio_dimensions_;
+  // Scratch buffer for evaluating string expressions.
+  std::string expression_value_;
 
   // String expressions evaluated into dimensions
-  std::vector<uint32_t> expressions_;
+  std::vector<DimensionExpression> expressions_;
   Map<std::string, size_t> input_expressions_;
+  // Dimensions derived from the peer node, including peer expressions.
+  std::vector<size_t> peer_indexes_;
 
   // Int expressions evaluated to metric values
   std::vector<uint32_t> int_expressions_;
@@ -279,18 +519,47 @@ class PluginRootContext : public RootContext {
   bool outbound_;
   bool debug_;
   bool use_host_header_fallback_;
+  bool share_request_info_ = false;
+
+  // Maps peer ID to the peer derived dimensions.
+  Map<std::string, PeerDimensions> peer_cache_;
+  int32_t max_peer_cache_size_;
 
   int64_t cache_hits_accumulator_ = 0;
   uint32_t cache_hits_;
   uint32_t cache_misses_;
+  uint32_t cache_evictions_;
+  uint32_t dimension_overflows_;
 
   // Resolved metric where value can be recorded.
   // Maps resolved dimensions to a set of related metrics.
-  std::unordered_map<IstioDimensions, std::vector<SimpleStat>,
-                     HashIstioDimensions>
-      metrics_;
+  MetricCache metrics_;
+  int32_t max_metric_cache_size_;
+  // CLOCK ring over the entries of metrics_ used to pick eviction victims.
+  std::vector<MetricCache::value_type*> metrics_clock_;
+  size_t metrics_clock_hand_ = 0;
+  // Set if metric values are batched and flushed on tick.
+  bool batch_metrics_ = false;
+  MetricBatch batch_;
+  // Ticks between TCP report wheel slots and between metric flushes.
+  uint64_t tcp_slot_ticks_ = 1;
+  uint64_t flush_ticks_ = 1;
+  uint64_t tick_count_ = 0;
+  long long tick_period_milis_ = 0;
+  long long tcp_report_duration_milis_ = 0;
+  long long tcp_slot_milis_ = 0;
+  long long flush_interval_milis_ = 0;
+  // Set while the wheel holds connections and the timer ticks once per slot.
+  bool tcp_wheel_active_ = false;
   Map<uint32_t, std::shared_ptr<::Wasm::Common::RequestInfo>>
       tcp_request_queue_;
+  // Hashed timer wheel spreading the periodic TCP reports over the reporting
+  // interval. Each slot holds the connections reported when the hand reaches
+  // it, placed by their open time.
+  std::vector<std::vector<uint32_t>> tcp_wheel_;
+  size_t tcp_wheel_hand_ = 0;
+  // Connections due for a report.
+  std::deque<uint32_t> tcp_report_backlog_;
   // Peer stats to be generated for a dimensioned metrics set.
   std::vector<StatGen> stats_;
 };
@@ -320,6 +589,9 @@ class PluginContext : public Context {
       cleanupTCPOnClose();
     }
     rootContext()->report(*request_info_, is_tcp_);
+    if (rootContext()->shareRequestInfo()) {
+      ::Wasm::Common::shareHTTPRequestInfo(*request_info_);
+    }
   };
 
   FilterStatus onNewConnection() override {
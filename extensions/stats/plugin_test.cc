@@ -41,35 +41,37 @@ namespace Plugin {
 namespace Stats {
 
 TEST(IstioDimensions, Hash) {
+  SymbolTable symbols;
   IstioDimensions d1(count_standard_labels);
   IstioDimensions d2(count_standard_labels);
-  d2[request_protocol] = "grpc";
+  d2[request_protocol] = symbols.intern("grpc");
   IstioDimensions d3(count_standard_labels);
-  d3[request_protocol] = "grpc";
-  d3[response_code] = "200";
+  d3[request_protocol] = symbols.intern("grpc");
+  d3[response_code] = symbols.intern("200");
   IstioDimensions d4(count_standard_labels);
-  d4[request_protocol] = "grpc";
-  d4[response_code] = "400";
+  d4[request_protocol] = symbols.intern("grpc");
+  d4[response_code] = symbols.intern("400");
   IstioDimensions d5(count_standard_labels);
-  d5[request_protocol] = "grpc";
-  d5[source_app] = "app_source";
+  d5[request_protocol] = symbols.intern("grpc");
+  d5[source_app] = symbols.intern("app_source");
   IstioDimensions d6(count_standard_labels);
-  d6[reporter] = source;
-  d6[request_protocol] = "grpc";
-  d6[source_app] = "app_source";
-  d6[source_version] = "v2";
+  d6[reporter] = symbols.intern(source);
+  d6[request_protocol] = symbols.intern("grpc");
+  d6[source_app] = symbols.intern("app_source");
+  d6[source_version] = symbols.intern("v2");
   IstioDimensions d7(count_standard_labels);
-  d7[request_protocol] = "grpc", d7[source_app] = "app_source",
-  d7[source_version] = "v2";
+  d7[request_protocol] = symbols.intern("grpc"),
+  d7[source_app] = symbols.intern("app_source"),
+  d7[source_version] = symbols.intern("v2");
   IstioDimensions d7_duplicate(count_standard_labels);
-  d7_duplicate[request_protocol] = "grpc";
-  d7_duplicate[source_app] = "app_source";
-  d7_duplicate[source_version] = "v2";
+  d7_duplicate[request_protocol] = symbols.intern("grpc");
+  d7_duplicate[source_app] = symbols.intern("app_source");
+  d7_duplicate[source_version] = symbols.intern("v2");
   IstioDimensions d8(count_standard_labels);
-  d8[request_protocol] = "grpc";
-  d8[source_app] = "app_source";
-  d8[source_version] = "v2";
-  d8[grpc_response_status] = "12";
+  d8[request_protocol] = symbols.intern("grpc");
+  d8[source_app] = symbols.intern("app_source");
+  d8[source_version] = symbols.intern("v2");
+  d8[grpc_response_status] = symbols.intern("12");
 
   // Must be unique except for d7 and d8.
   std::set<size_t> hashes;
@@ -85,6 +87,67 @@ TEST(IstioDimensions, Hash) {
   EXPECT_EQ(hashes.size(), 8);
 }
 
+TEST(SymbolTable, Intern) {
+  SymbolTable symbols;
+  EXPECT_EQ(symbols.intern(""), kEmptySymbol);
+  EXPECT_EQ(symbols.intern(unknown), kUnknownSymbol);
+
+  const auto grpc = symbols.intern("grpc");
+  const auto http = symbols.intern(std::string("http"));
+  EXPECT_NE(grpc, http);
+  EXPECT_EQ(symbols.intern(std::string("grpc")), grpc);
+  EXPECT_EQ(symbols.value(grpc), "grpc");
+  EXPECT_EQ(symbols.value(http), "http");
+  EXPECT_EQ(symbols.size(), 4);
+
+  symbols.clear();
+  EXPECT_EQ(symbols.size(), 2);
+  EXPECT_EQ(symbols.value(kUnknownSymbol), unknown);
+}
+
+TEST(CompileExpression, Attribute) {
+  auto host = compileExpression(" request.host ");
+  ASSERT_TRUE(host.has_value());
+  EXPECT_EQ(host->kind, SimpleExpression::Kind::Attribute);
+  EXPECT_EQ(host->path, std::vector<std::string>({"request", "host"}));
+
+  auto header = compileExpression("request.headers['x-tenant']");
+  ASSERT_TRUE(header.has_value());
+  EXPECT_EQ(header->kind, SimpleExpression::Kind::Attribute);
+  EXPECT_EQ(header->path,
+            std::vector<std::string>({"request", "headers", "x-tenant"}));
+  auto double_quoted = compileExpression("request.headers[\"x-tenant\"]");
+  ASSERT_TRUE(double_quoted.has_value());
+  EXPECT_EQ(double_quoted->path, header->path);
+}
+
+TEST(CompileExpression, Peer) {
+  auto label = compileExpression("upstream_peer.labels['app']");
+  ASSERT_TRUE(label.has_value());
+  EXPECT_EQ(label->kind, SimpleExpression::Kind::PeerLabel);
+  EXPECT_EQ(label->peer, "upstream_peer");
+  EXPECT_EQ(label->path, std::vector<std::string>({"app"}));
+
+  auto field = compileExpression("downstream_peer.workload_name");
+  ASSERT_TRUE(field.has_value());
+  EXPECT_EQ(field->kind, SimpleExpression::Kind::PeerField);
+  EXPECT_EQ(field->peer, "downstream_peer");
+  EXPECT_EQ(field->path, std::vector<std::string>({"workload_name"}));
+}
+
+TEST(CompileExpression, Complex) {
+  EXPECT_FALSE(compileExpression("request.size").has_value());
+  EXPECT_FALSE(compileExpression("request.host + 'x'").has_value());
+  EXPECT_FALSE(compileExpression("request.headers['x'] == 'y'").has_value());
+  EXPECT_FALSE(compileExpression("request.headers['x']['y']").has_value());
+  EXPECT_FALSE(compileExpression("request.headers['x\\'y']").has_value());
+  EXPECT_FALSE(compileExpression("upstream_peer.labels").has_value());
+  EXPECT_FALSE(compileExpression("upstream_peer.platform_metadata['x']")
+                   .has_value());
+  EXPECT_FALSE(compileExpression("has(request.host)").has_value());
+  EXPECT_FALSE(compileExpression("").has_value());
+}
+
 }  // namespace Stats
 
 // WASM_EPILOG
@@ -19,6 +19,7 @@
 #include <string>
 
 #include "absl/base/internal/endian.h"
+#include "absl/strings/match.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "common/buffer/buffer_impl.h"
@@ -27,6 +28,9 @@
 #include "envoy/stats/scope.h"
 #include "extensions/common/context.h"
 #include "extensions/common/wasm/wasm_state.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/wire_format_lite.h"
 #include "src/envoy/tcp/metadata_exchange/metadata_exchange_initial_header.h"
 
 namespace Envoy {
@@ -34,25 +38,6 @@ namespace Tcp {
 namespace MetadataExchange {
 namespace {
 
-std::unique_ptr<::Envoy::Buffer::OwnedImpl> constructProxyHeaderData(
-    const Envoy::ProtobufWkt::Any& proxy_data) {
-  MetadataExchangeInitialHeader initial_header;
-  std::string proxy_data_str = proxy_data.SerializeAsString();
-  // Converting from host to network byte order so that most significant byte is
-  // placed first.
-  initial_header.magic =
-      absl::ghtonl(MetadataExchangeInitialHeader::magic_number);
-  initial_header.data_size = absl::ghtonl(proxy_data_str.length());
-
-  ::Envoy::Buffer::OwnedImpl initial_header_buffer{
-      absl::string_view(reinterpret_cast<const char*>(&initial_header),
-                        sizeof(MetadataExchangeInitialHeader))};
-  auto proxy_data_buffer =
-      std::make_unique<::Envoy::Buffer::OwnedImpl>(proxy_data_str);
-  proxy_data_buffer->prepend(initial_header_buffer);
-  return proxy_data_buffer;
-}
-
 bool serializeToStringDeterministic(const google::protobuf::Struct& metadata,
                                     std::string* metadata_bytes) {
   google::protobuf::io::StringOutputStream md(metadata_bytes);
@@ -65,16 +50,151 @@ bool serializeToStringDeterministic(const google::protobuf::Struct& metadata,
   return true;
 }
 
+// Builds the initial header and the proxy data of the local node metadata
+// and ID. The proxy data is an Any of a Struct.
+std::shared_ptr<const std::string> buildNodeMetadataPayload(
+    const LocalInfo::LocalInfo& local_info) {
+  Envoy::ProtobufWkt::Struct data;
+  Envoy::ProtobufWkt::Struct* metadata =
+      (*data.mutable_fields())[ExchangeMetadataHeader].mutable_struct_value();
+  if (local_info.node().has_metadata()) {
+    // The metadata is left as extracted so far if extraction fails.
+    Wasm::Common::extractNodeMetadataValue(local_info.node().metadata(),
+                                           metadata);
+  }
+  const std::string& metadata_id = local_info.node().id();
+  if (!metadata_id.empty()) {
+    (*data.mutable_fields())[ExchangeMetadataHeaderId].set_string_value(
+        metadata_id);
+  }
+  if (data.fields_size() == 0) {
+    return nullptr;
+  }
+
+  Envoy::ProtobufWkt::Any metadata_any_value;
+  *metadata_any_value.mutable_type_url() = StructTypeUrl;
+  serializeToStringDeterministic(data, metadata_any_value.mutable_value());
+  const std::string proxy_data = metadata_any_value.SerializeAsString();
+
+  MetadataExchangeInitialHeader initial_header;
+  // Converting from host to network byte order so that most significant byte is
+  // placed first.
+  initial_header.magic =
+      absl::ghtonl(MetadataExchangeInitialHeader::magic_number);
+  initial_header.data_size = absl::ghtonl(proxy_data.length());
+  auto payload = std::make_shared<std::string>(
+      reinterpret_cast<const char*>(&initial_header),
+      sizeof(MetadataExchangeInitialHeader));
+  payload->append(proxy_data);
+  return payload;
+}
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
+
+// Tags of the google.protobuf.Any fields read.
+constexpr uint32_t kAnyTypeUrlTag =
+    WireFormatLite::MakeTag(1, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t kAnyValueTag =
+    WireFormatLite::MakeTag(2, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+// The fields of the proxy data read by the filter.
+struct ProxyData {
+  bool has_metadata = false;
+  bool has_metadata_id = false;
+  // Serialized struct of the peer node metadata.
+  absl::string_view metadata;
+  absl::string_view metadata_id;
+  // Storage of the fields split across buffer slices.
+  std::string metadata_scratch;
+  std::string metadata_id_scratch;
+};
+
+// Reads the proxy data, an Any of a Struct, from the buffer slices. The peer
+// node metadata is kept serialized, to be converted to a flatbuffer directly.
+bool readProxyData(const Buffer::Instance& buffer, uint64_t length,
+                   absl::string_view metadata_key,
+                   absl::string_view metadata_id_key, ProxyData* proxy_data) {
+  std::vector<std::unique_ptr<google::protobuf::io::ArrayInputStream>>
+      slice_streams;
+  std::vector<google::protobuf::io::ZeroCopyInputStream*> streams;
+  for (const auto& slice : buffer.getRawSlices()) {
+    slice_streams.push_back(
+        std::make_unique<google::protobuf::io::ArrayInputStream>(
+            slice.mem_, static_cast<int>(slice.len_)));
+    streams.push_back(slice_streams.back().get());
+  }
+  google::protobuf::io::ConcatenatingInputStream concatenated(streams.data(),
+                                                              streams.size());
+  google::protobuf::io::LimitingInputStream limited(&concatenated, length);
+  CodedInputStream input(&limited);
+
+  bool is_struct = false;
+  while (const uint32_t tag = input.ReadTag()) {
+    if (tag == kAnyTypeUrlTag) {
+      std::string type_url;
+      if (!WireFormatLite::ReadString(&input, &type_url)) {
+        return false;
+      }
+      is_struct = absl::EndsWith(type_url, "/google.protobuf.Struct");
+      continue;
+    }
+    if (tag != kAnyValueTag) {
+      if (!WireFormatLite::SkipField(&input, tag)) {
+        return false;
+      }
+      continue;
+    }
+    // Later entries replace earlier ones with the same key.
+    // Values of another kind read as empty, as with Value::struct_value()
+    // and Value::string_value().
+    const bool ok = ::Wasm::Common::readStructEntries(
+        input, [&](absl::string_view key, absl::string_view value,
+                   std::string* value_copy) {
+          if (key == metadata_key) {
+            proxy_data->has_metadata = true;
+            if (value_copy != nullptr) {
+              proxy_data->metadata_scratch.swap(*value_copy);
+              value = proxy_data->metadata_scratch;
+            }
+            if (!::Wasm::Common::readValueKind(
+                    value, ::Wasm::Common::ValueKind::Struct,
+                    &proxy_data->metadata)) {
+              proxy_data->metadata = {};
+            }
+          } else if (key == metadata_id_key) {
+            proxy_data->has_metadata_id = true;
+            if (value_copy != nullptr) {
+              proxy_data->metadata_id_scratch.swap(*value_copy);
+              value = proxy_data->metadata_id_scratch;
+            }
+            if (!::Wasm::Common::readValueKind(
+                    value, ::Wasm::Common::ValueKind::String,
+                    &proxy_data->metadata_id)) {
+              proxy_data->metadata_id = {};
+            }
+          }
+          return true;
+        });
+    if (!ok) {
+      return false;
+    }
+  }
+  return input.ConsumedEntireMessage() && is_struct;
+}
+
 }  // namespace
 
 MetadataExchangeConfig::MetadataExchangeConfig(
     const std::string& stat_prefix, const std::string& protocol,
-    const FilterDirection filter_direction, Stats::Scope& scope)
+    const FilterDirection filter_direction, Stats::Scope& scope,
+    const LocalInfo::LocalInfo& local_info)
     : scope_(scope),
       stat_prefix_(stat_prefix),
       protocol_(protocol),
       filter_direction_(filter_direction),
-      stats_(generateStats(stat_prefix, scope)) {}
+      stats_(generateStats(stat_prefix, scope)),
+      node_metadata_payload_(buildNodeMetadataPayload(local_info)) {}
 
 Network::FilterStatus MetadataExchangeFilter::onData(Buffer::Instance& data,
                                                      bool) {
@@ -185,24 +305,19 @@ void MetadataExchangeFilter::writeNodeMetadata() {
     return;
   }
 
-  Envoy::ProtobufWkt::Struct data;
-  Envoy::ProtobufWkt::Struct* metadata =
-      (*data.mutable_fields())[ExchangeMetadataHeader].mutable_struct_value();
-  getMetadata(metadata);
-  std::string metadata_id = getMetadataId();
-  if (!metadata_id.empty()) {
-    (*data.mutable_fields())[ExchangeMetadataHeaderId].set_string_value(
-        metadata_id);
-  }
-  if (data.fields_size() > 0) {
-    Envoy::ProtobufWkt::Any metadata_any_value;
-    *metadata_any_value.mutable_type_url() = StructTypeUrl;
-    std::string serialized_data;
-    serializeToStringDeterministic(data, &serialized_data);
-    *metadata_any_value.mutable_value() = serialized_data;
-    std::unique_ptr<::Envoy::Buffer::OwnedImpl> buf =
-        constructProxyHeaderData(metadata_any_value);
-    write_callbacks_->injectWriteDataToFilterChain(*buf, false);
+  const auto& payload = config_->node_metadata_payload_;
+  if (payload != nullptr) {
+    // The fragment refers to the shared payload, and keeps it alive until the
+    // connection has written it out.
+    auto* fragment = new Buffer::BufferFragmentImpl(
+        payload->data(), payload->size(),
+        [payload](const void*, size_t,
+                  const Buffer::BufferFragmentImpl* fragment) {
+          delete fragment;
+        });
+    Buffer::OwnedImpl buf;
+    buf.addBufferFragment(*fragment);
+    write_callbacks_->injectWriteDataToFilterChain(buf, false);
     config_->stats().metadata_added_.inc();
   }
 
@@ -250,11 +365,9 @@ void MetadataExchangeFilter::tryReadProxyData(Buffer::Instance& data) {
     conn_state_ = NeedMoreDataProxyHeader;
     return;
   }
-  std::string proxy_data_buf =
-      std::string(static_cast<const char*>(data.linearize(proxy_data_length_)),
-                  proxy_data_length_);
-  Envoy::ProtobufWkt::Any proxy_data;
-  if (!proxy_data.ParseFromString(proxy_data_buf)) {
+  ProxyData proxy_data;
+  if (!readProxyData(data, proxy_data_length_, ExchangeMetadataHeader,
+                     ExchangeMetadataHeaderId, &proxy_data)) {
     config_->stats().header_not_found_.inc();
     setMetadataNotFoundFilterState();
     ENVOY_LOG(trace,
@@ -262,33 +375,26 @@ void MetadataExchangeFilter::tryReadProxyData(Buffer::Instance& data) {
     conn_state_ = Invalid;
     return;
   }
-  data.drain(proxy_data_length_);
 
-  // Set Metadata
-  Envoy::ProtobufWkt::Struct value_struct =
-      Envoy::MessageUtil::anyConvert<Envoy::ProtobufWkt::Struct>(proxy_data);
-  auto key_metadata_it = value_struct.fields().find(ExchangeMetadataHeader);
-  if (key_metadata_it != value_struct.fields().end()) {
-    Envoy::ProtobufWkt::Value val = key_metadata_it->second;
-    flatbuffers::FlatBufferBuilder fbb;
-    if (::Wasm::Common::extractNodeFlatBuffer(val.struct_value(), fbb)) {
-      setFilterState(config_->filter_direction_ == FilterDirection::Downstream
-                         ? DownstreamMetadataKey
-                         : UpstreamMetadataKey,
-                     absl::string_view(
-                         reinterpret_cast<const char*>(fbb.GetBufferPointer()),
-                         fbb.GetSize()));
-    }
+  // Set Metadata. The proxy data views the buffer, so it is drained after.
+  flatbuffers::FlatBufferBuilder fbb;
+  if (proxy_data.has_metadata &&
+      ::Wasm::Common::extractNodeFlatBufferFromBytes(proxy_data.metadata,
+                                                     fbb)) {
+    setFilterState(config_->filter_direction_ == FilterDirection::Downstream
+                       ? DownstreamMetadataKey
+                       : UpstreamMetadataKey,
+                   absl::string_view(
+                       reinterpret_cast<const char*>(fbb.GetBufferPointer()),
+                       fbb.GetSize()));
   }
-  const auto key_metadata_id_it =
-      value_struct.fields().find(ExchangeMetadataHeaderId);
-  if (key_metadata_id_it != value_struct.fields().end()) {
-    Envoy::ProtobufWkt::Value val = key_metadata_id_it->second;
+  if (proxy_data.has_metadata_id) {
     setFilterState(config_->filter_direction_ == FilterDirection::Downstream
                        ? DownstreamMetadataIdKey
                        : UpstreamMetadataIdKey,
-                   val.string_value());
+                   proxy_data.metadata_id);
   }
+  data.drain(proxy_data_length_);
 }
 
 void MetadataExchangeFilter::setFilterState(const std::string& key,
@@ -300,23 +406,6 @@ void MetadataExchangeFilter::setFilterState(const std::string& key,
       StreamInfo::FilterState::LifeSpan::DownstreamConnection);
 }
 
-void MetadataExchangeFilter::getMetadata(google::protobuf::Struct* metadata) {
-  if (local_info_.node().has_metadata()) {
-    google::protobuf::Struct node_metadata = local_info_.node().metadata();
-    google::protobuf::Value value_struct;
-
-    const auto status =
-        Wasm::Common::extractNodeMetadataValue(node_metadata, metadata);
-    if (!status.ok()) {
-      return;
-    }
-  }
-}
-
-std::string MetadataExchangeFilter::getMetadataId() {
-  return local_info_.node().id();
-}
-
 void MetadataExchangeFilter::setMetadataNotFoundFilterState() {
   const std::string key =
       config_->filter_direction_ == FilterDirection::Downstream
@@ -53,6 +53,13 @@ struct MetadataExchangeStats {
  */
 enum FilterDirection { Downstream, Upstream };
 
+// Keys of the node metadata and ID in the proxy data.
+constexpr char ExchangeMetadataHeader[] = "x-envoy-peer-metadata";
+constexpr char ExchangeMetadataHeaderId[] = "x-envoy-peer-metadata-id";
+
+// Type url of google::protobug::struct.
+constexpr char StructTypeUrl[] = "type.googleapis.com/google.protobuf.Struct";
+
 /**
  * Configuration for the MetadataExchange filter.
  */
@@ -61,7 +68,8 @@ class MetadataExchangeConfig {
   MetadataExchangeConfig(const std::string& stat_prefix,
                          const std::string& protocol,
                          const FilterDirection filter_direction,
-                         Stats::Scope& scope);
+                         Stats::Scope& scope,
+                         const LocalInfo::LocalInfo& local_info);
 
   const MetadataExchangeStats& stats() { return stats_; }
 
@@ -75,6 +83,10 @@ class MetadataExchangeConfig {
   const FilterDirection filter_direction_;
   // Stats for MetadataExchange Filter.
   MetadataExchangeStats stats_;
+  // Initial header and proxy data of the local node, written on each
+  // connection. It only depends on the local node, so it is built once and
+  // shared by the connections. Null if there is nothing to write.
+  std::shared_ptr<const std::string> node_metadata_payload_;
 
  private:
   MetadataExchangeStats generateStats(const std::string& prefix,
@@ -92,11 +104,8 @@ using MetadataExchangeConfigSharedPtr = std::shared_ptr<MetadataExchangeConfig>;
 class MetadataExchangeFilter : public Network::Filter,
                                protected Logger::Loggable<Logger::Id::filter> {
  public:
-  MetadataExchangeFilter(MetadataExchangeConfigSharedPtr config,
-                         const LocalInfo::LocalInfo& local_info)
-      : config_(config),
-        local_info_(local_info),
-        conn_state_(ConnProtocolNotRead) {}
+  MetadataExchangeFilter(MetadataExchangeConfigSharedPtr config)
+      : config_(config), conn_state_(ConnProtocolNotRead) {}
 
   // Network::ReadFilter
   Network::FilterStatus onData(Buffer::Instance& data,
@@ -130,19 +139,11 @@ class MetadataExchangeFilter : public Network::Filter,
   // Helper function to share the metadata with other filters.
   void setFilterState(const std::string& key, absl::string_view value);
 
-  // Helper function to get Dynamic metadata.
-  void getMetadata(google::protobuf::Struct* metadata);
-
-  // Helper function to get metadata id.
-  std::string getMetadataId();
-
   // Helper function to set filterstate when no client mxc found.
   void setMetadataNotFoundFilterState();
 
   // Config for MetadataExchange filter.
   MetadataExchangeConfigSharedPtr config_;
-  // LocalInfo instance.
-  const LocalInfo::LocalInfo& local_info_;
   // Read callback instance.
   Network::ReadFilterCallbacks* read_callbacks_{};
   // Write callback instance.
@@ -164,13 +165,6 @@ class MetadataExchangeFilter : public Network::Filter,
   const std::string MetadataNotFoundValue =
       "envoy.wasm.metadata_exchange.peer_unknown";
 
-  const std::string ExchangeMetadataHeader = "x-envoy-peer-metadata";
-  const std::string ExchangeMetadataHeaderId = "x-envoy-peer-metadata-id";
-
-  // Type url of google::protobug::struct.
-  const std::string StructTypeUrl =
-      "type.googleapis.com/google.protobuf.Struct";
-
   // Captures the state machine of what is going on in the filter.
   enum {
     ConnProtocolNotRead,        // Connection Protocol has not been read yet
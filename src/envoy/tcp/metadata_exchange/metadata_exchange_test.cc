@@ -17,6 +17,7 @@
 
 #include "common/buffer/buffer_impl.h"
 #include "common/protobuf/protobuf.h"
+#include "extensions/common/wasm/wasm_state.h"
 #include "gmock/gmock.h"
 #include "google/protobuf/util/message_differencer.h"
 #include "gtest/gtest.h"
@@ -58,11 +59,6 @@ class MetadataExchangeFilterTest : public testing::Test {
   MetadataExchangeFilterTest() { ENVOY_LOG_MISC(info, "test"); }
 
   void initialize() {
-    config_ = std::make_shared<MetadataExchangeConfig>(
-        stat_prefix_, "istio2", FilterDirection::Downstream, scope_);
-    filter_ = std::make_unique<MetadataExchangeFilter>(config_, local_info_);
-    filter_->initializeReadFilterCallbacks(read_filter_callbacks_);
-    filter_->initializeWriteFilterCallbacks(write_filter_callbacks_);
     metadata_node_.set_id("test");
     auto node_metadata_map =
         metadata_node_.mutable_metadata()->mutable_fields();
@@ -72,6 +68,13 @@ class MetadataExchangeFilterTest : public testing::Test {
     EXPECT_CALL(read_filter_callbacks_.connection_, streamInfo())
         .WillRepeatedly(ReturnRef(stream_info_));
     EXPECT_CALL(local_info_, node()).WillRepeatedly(ReturnRef(metadata_node_));
+    // The node metadata written by the filter is built along with the config.
+    config_ = std::make_shared<MetadataExchangeConfig>(
+        stat_prefix_, "istio2", FilterDirection::Downstream, scope_,
+        local_info_);
+    filter_ = std::make_unique<MetadataExchangeFilter>(config_);
+    filter_->initializeReadFilterCallbacks(read_filter_callbacks_);
+    filter_->initializeWriteFilterCallbacks(write_filter_callbacks_);
   }
 
   void initializeStructValues() {
@@ -126,6 +129,58 @@ TEST_F(MetadataExchangeFilterTest, MetadataExchangeFound) {
   EXPECT_EQ(1UL, config_->stats().alpn_protocol_found_.value());
 }
 
+TEST_F(MetadataExchangeFilterTest, MetadataExchangeSplitAcrossSlices) {
+  initialize();
+  initializeStructValues();
+
+  EXPECT_CALL(read_filter_callbacks_.connection_, nextProtocol())
+      .WillRepeatedly(Return("istio2"));
+
+  const std::string peer_id =
+      "sidecar~10.0.0.1~productpage-v1.default~default.svc.cluster.local";
+  Envoy::ProtobufWkt::Struct proxy_data;
+  *(*proxy_data.mutable_fields())[ExchangeMetadataHeader]
+       .mutable_struct_value() = productpage_value_;
+  (*proxy_data.mutable_fields())[ExchangeMetadataHeaderId].set_string_value(
+      peer_id);
+  Envoy::ProtobufWkt::Any proxy_data_any;
+  *proxy_data_any.mutable_type_url() =
+      "type.googleapis.com/google.protobuf.Struct";
+  *proxy_data_any.mutable_value() = proxy_data.SerializeAsString();
+  ::Envoy::Buffer::OwnedImpl header;
+  MetadataExchangeInitialHeader initial_header;
+  ConstructProxyHeaderData(header, proxy_data_any, &initial_header);
+  header.add("world");
+
+  // Add the data in small slices, so that the fields of the proxy data span
+  // several of them and are copied while read.
+  const std::string serialized = header.toString();
+  std::vector<std::unique_ptr<::Envoy::Buffer::BufferFragmentImpl>> fragments;
+  ::Envoy::Buffer::OwnedImpl data;
+  for (size_t i = 0; i < serialized.size(); i += 7) {
+    fragments.push_back(std::make_unique<::Envoy::Buffer::BufferFragmentImpl>(
+        serialized.data() + i, std::min<size_t>(7, serialized.size() - i),
+        nullptr));
+    data.addBufferFragment(*fragments.back());
+  }
+  ASSERT_GT(data.getRawSlices().size(), 2);
+
+  EXPECT_EQ(Envoy::Network::FilterStatus::Continue,
+            filter_->onData(data, false));
+  EXPECT_EQ(data.toString(), "world");
+
+  const auto& filter_state = stream_info_.filterState();
+  EXPECT_TRUE(
+      filter_state->hasDataWithName("envoy.wasm.metadata_exchange.downstream"));
+  EXPECT_EQ(filter_state
+                ->getDataReadOnly<::Envoy::Extensions::Common::Wasm::WasmState>(
+                    "envoy.wasm.metadata_exchange.downstream_id")
+                .value(),
+            peer_id);
+  EXPECT_EQ(0UL, config_->stats().header_not_found_.value());
+  EXPECT_EQ(1UL, config_->stats().alpn_protocol_found_.value());
+}
+
 TEST_F(MetadataExchangeFilterTest, MetadataExchangeNotFound) {
   initialize();
 
@@ -89,3 +89,33 @@ func (me *ExactStat) Matches(params *Params, that *dto.MetricFamily) error {
 }
 
 var _ StatMatcher = &ExactStat{}
+
+// LabelStat matches a metric family with a metric for each of the label sets.
+// Labels that are not listed are not compared.
+type LabelStat struct {
+	Labels []map[string]string
+}
+
+func (ls *LabelStat) Matches(_ *Params, that *dto.MetricFamily) error {
+	for _, labels := range ls.Labels {
+		found := false
+		for _, metric := range that.GetMetric() {
+			matched := 0
+			for _, label := range metric.GetLabel() {
+				if value, ok := labels[label.GetName()]; ok && value == label.GetValue() {
+					matched++
+				}
+			}
+			if matched == len(labels) {
+				found = true
+				break
+			}
+		}
+		if !found {
+			return fmt.Errorf("no metric with labels %v, got: %v", labels, that)
+		}
+	}
+	return nil
+}
+
+var _ StatMatcher = &LabelStat{}
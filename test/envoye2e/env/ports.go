@@ -38,6 +38,11 @@ const (
 	BasicHTTP
 	BasicHTTPwithTLS
 	HTTPExchange
+	HTTPExchangePeerChange
+	HTTPExchangeFlat
+	HTTPExchangeCompact
+	HTTPExchangeCompactRequest
+	HTTPExchangeConnectionPeer
 	StackDriverPayload
 	StackDriverPayloadGateway
 	StackDriverPayloadWithTLS
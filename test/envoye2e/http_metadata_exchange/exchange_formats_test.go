@@ -0,0 +1,260 @@
+// Copyright 2020 Istio Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package client_test
+
+import (
+	"fmt"
+	"testing"
+	"time"
+
+	"istio.io/proxy/test/envoye2e/driver"
+	"istio.io/proxy/test/envoye2e/env"
+)
+
+const ClientHTTPStatsListener = `
+name: client
+traffic_direction: OUTBOUND
+address:
+  socket_address:
+    address: 127.0.0.1
+    port_value: {{ .Vars.ClientPort }}
+filter_chains:
+- filters:
+  - name: envoy.http_connection_manager
+    typed_config:
+      "@type": type.googleapis.com/envoy.extensions.filters.network.http_connection_manager.v3.HttpConnectionManager
+      codec_type: AUTO
+      stat_prefix: client
+      http_filters:
+      - name: envoy.filters.http.wasm
+        typed_config:
+          "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+          type_url: envoy.extensions.filters.http.wasm.v3.Wasm
+          value:
+            config:
+              root_id: "mx_outbound"
+              vm_config:
+                runtime: envoy.wasm.runtime.null
+                code:
+                  local:
+                    inline_string: envoy.wasm.metadata_exchange
+              configuration: "{{ .Vars.ClientMetadataExchangeConfig }}"
+      - name: envoy.filters.http.wasm
+        typed_config:
+          "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+          type_url: envoy.extensions.filters.http.wasm.v3.Wasm
+          value:
+            config:
+              root_id: "stats_outbound"
+              vm_config:
+                vm_id: stats_outbound
+                runtime: envoy.wasm.runtime.null
+                code:
+                  local:
+                    inline_string: envoy.wasm.stats
+              configuration: |
+                {{ .Vars.StatsFilterClientConfig }}
+      - name: envoy.router
+      route_config:
+        name: client
+        virtual_hosts:
+        - name: client
+          domains: ["*"]
+          routes:
+          - match: { prefix: / }
+            route:
+              cluster: server
+              timeout: 0s
+`
+
+func exchangeParams(ports *env.Ports, clientConfig, serverConfig string) *driver.Params {
+	params := &driver.Params{
+		Vars: map[string]string{
+			"ClientPort":                   fmt.Sprintf("%d", ports.AppToClientProxyPort),
+			"BackendPort":                  fmt.Sprintf("%d", ports.BackendPort),
+			"ClientAdmin":                  fmt.Sprintf("%d", ports.ClientAdminPort),
+			"ServerAdmin":                  fmt.Sprintf("%d", ports.ServerAdminPort),
+			"ServerPort":                   fmt.Sprintf("%d", ports.ClientToServerProxyPort),
+			"RequestCount":                 "10",
+			"ClientMetadataExchangeConfig": clientConfig,
+			"MetadataExchangeConfig":       serverConfig,
+			"StatsConfig":                  driver.LoadTestData("testdata/bootstrap/stats.yaml.tmpl"),
+			"StatsFilterClientConfig":      driver.LoadTestJSON("testdata/stats/client_config.yaml"),
+			"StatsFilterServerConfig":      driver.LoadTestJSON("testdata/stats/server_config.yaml"),
+		},
+		XDS: int(ports.XDSPort),
+	}
+	params.Vars["ClientMetadata"] = params.LoadTestData("testdata/client_node_metadata.json.tmpl")
+	params.Vars["ServerMetadata"] = params.LoadTestData("testdata/server_node_metadata.json.tmpl")
+	return params
+}
+
+// runClientServerExchange sends requests from the client to the server proxy
+// and checks that both report every request with the metadata of their peer.
+func runClientServerExchange(t *testing.T, ports *env.Ports, params *driver.Params) {
+	if err := (&driver.Scenario{
+		[]driver.Step{
+			&driver.XDS{},
+			&driver.Update{Node: "client", Version: "0", Listeners: []string{ClientHTTPStatsListener}},
+			&driver.Update{Node: "server", Version: "0", Listeners: []string{ServerHTTPStatsListener}},
+			&driver.Envoy{Bootstrap: params.LoadTestData("testdata/bootstrap/server.yaml.tmpl")},
+			&driver.Envoy{Bootstrap: params.LoadTestData("testdata/bootstrap/client.yaml.tmpl")},
+			&driver.Sleep{1 * time.Second},
+			&driver.Repeat{N: 10, Step: driver.Get(ports.AppToClientProxyPort, "hello, world!")},
+			&driver.Stats{ports.ClientAdminPort, map[string]driver.StatMatcher{
+				"istio_requests_total": &driver.ExactStat{"testdata/metric/client_request_total.yaml.tmpl"},
+			}},
+			&driver.Stats{ports.ServerAdminPort, map[string]driver.StatMatcher{
+				"istio_requests_total": &driver.ExactStat{"testdata/metric/server_request_total.yaml.tmpl"},
+			}},
+		},
+	}).Run(params); err != nil {
+		t.Fatal(err)
+	}
+}
+
+// The client sends its metadata as a "fb1." flatbuffer, and the server replies
+// in the same format.
+func TestHTTPExchangeFlat(t *testing.T) {
+	ports := env.NewPorts(env.HTTPExchangeFlat)
+	params := exchangeParams(ports,
+		"{ max_peer_cache_size: 20, send_flat_metadata: true }",
+		"{ max_peer_cache_size: 20 }")
+	runClientServerExchange(t, ports, params)
+}
+
+// The client only sends its ID and metadata hash after the first request, and
+// the server resolves it from its cache.
+func TestHTTPExchangeCompact(t *testing.T) {
+	ports := env.NewPorts(env.HTTPExchangeCompact)
+	params := exchangeParams(ports,
+		"{ max_peer_cache_size: 20, compact_metadata: true }",
+		"{ max_peer_cache_size: 20 }")
+	runClientServerExchange(t, ports, params)
+}
+
+// The server asks for the full metadata of a downstream peer it has not
+// cached, and uses it once the peer sends it.
+func TestHTTPExchangeCompactRequest(t *testing.T) {
+	ports := env.NewPorts(env.HTTPExchangeCompactRequest)
+	params := exchangeParams(ports, "", "{ max_peer_cache_size: 20 }")
+	hash := "0123456789abcdef"
+	if err := (&driver.Scenario{
+		[]driver.Step{
+			&driver.XDS{},
+			&driver.Update{Node: "server", Version: "0", Listeners: []string{ServerHTTPStatsListener}},
+			&driver.Envoy{Bootstrap: params.LoadTestData("testdata/bootstrap/server.yaml.tmpl")},
+			&driver.Sleep{1 * time.Second},
+			&driver.HTTPCall{
+				Port: ports.ClientToServerProxyPort,
+				Body: "hello, world!",
+				RequestHeaders: map[string]string{
+					"connection":                 "close",
+					"x-envoy-peer-metadata-id":   "client",
+					"x-envoy-peer-metadata-hash": hash,
+				},
+				ResponseHeaders: map[string]string{
+					"x-envoy-peer-metadata-id":      "server",
+					"x-envoy-peer-metadata-hash":    driver.Any,
+					"x-envoy-peer-metadata-request": "1",
+					"x-envoy-peer-metadata":         driver.None,
+				},
+			},
+			&driver.HTTPCall{
+				Port: ports.ClientToServerProxyPort,
+				Body: "hello, world!",
+				RequestHeaders: map[string]string{
+					"connection":                    "close",
+					"x-envoy-peer-metadata-id":      "client",
+					"x-envoy-peer-metadata-hash":    hash,
+					"x-envoy-peer-metadata-request": "1",
+					"x-envoy-peer-metadata":         EncodeMetadata(t, params),
+				},
+				ResponseHeaders: map[string]string{
+					"x-envoy-peer-metadata-id":      "server",
+					"x-envoy-peer-metadata-hash":    driver.Any,
+					"x-envoy-peer-metadata-request": driver.None,
+					"x-envoy-peer-metadata":         driver.Any,
+				},
+			},
+			&driver.HTTPCall{
+				Port: ports.ClientToServerProxyPort,
+				Body: "hello, world!",
+				RequestHeaders: map[string]string{
+					"x-envoy-peer-metadata-id":   "client",
+					"x-envoy-peer-metadata-hash": hash,
+				},
+				ResponseHeaders: map[string]string{
+					"x-envoy-peer-metadata-id":      "server",
+					"x-envoy-peer-metadata-hash":    driver.Any,
+					"x-envoy-peer-metadata-request": driver.None,
+					"x-envoy-peer-metadata":         driver.None,
+				},
+			},
+			&driver.Stats{ports.ServerAdminPort, map[string]driver.StatMatcher{
+				"istio_requests_total": &driver.LabelStat{[]map[string]string{
+					{"source_app": "unknown"},
+					{"source_app": "productpage"},
+				}},
+			}},
+		},
+	}).Run(params); err != nil {
+		t.Fatal(err)
+	}
+}
+
+// The server reuses the peer of a connection for the later requests of the
+// connection, which do not carry the peer metadata.
+func TestHTTPExchangeConnectionPeer(t *testing.T) {
+	ports := env.NewPorts(env.HTTPExchangeConnectionPeer)
+	params := exchangeParams(ports, "", "{ max_peer_cache_size: 20 }")
+	if err := (&driver.Scenario{
+		[]driver.Step{
+			&driver.XDS{},
+			&driver.Update{Node: "server", Version: "0", Listeners: []string{ServerHTTPStatsListener}},
+			&driver.Envoy{Bootstrap: params.LoadTestData("testdata/bootstrap/server.yaml.tmpl")},
+			&driver.Sleep{1 * time.Second},
+			&driver.HTTPCall{
+				Port: ports.ClientToServerProxyPort,
+				Body: "hello, world!",
+				RequestHeaders: map[string]string{
+					"x-envoy-peer-metadata-id": "client",
+					"x-envoy-peer-metadata":    EncodeMetadata(t, params),
+				},
+				ResponseHeaders: map[string]string{
+					"x-envoy-peer-metadata-id": "server",
+					"x-envoy-peer-metadata":    driver.Any,
+				},
+			},
+			// The client keeps the connection open, so this request is sent on
+			// the same connection.
+			&driver.HTTPCall{
+				Port: ports.ClientToServerProxyPort,
+				Body: "hello, world!",
+				ResponseHeaders: map[string]string{
+					"x-envoy-peer-metadata-id": "server",
+					"x-envoy-peer-metadata":    driver.Any,
+				},
+			},
+			&driver.Stats{ports.ServerAdminPort, map[string]driver.StatMatcher{
+				"istio_requests_total": &driver.LabelStat{[]map[string]string{
+					{"source_app": "productpage"},
+				}},
+			}},
+		},
+	}).Run(params); err != nil {
+		t.Fatal(err)
+	}
+}
@@ -17,6 +17,7 @@ package client_test
 import (
 	"encoding/base64"
 	"fmt"
+	"strings"
 	"testing"
 	"time"
 
@@ -67,9 +68,69 @@ filter_chains:
               timeout: 0s
 `
 
+const ServerHTTPStatsListener = `
+name: server
+traffic_direction: INBOUND
+address:
+  socket_address:
+    address: 127.0.0.1
+    port_value: {{ .Vars.ServerPort }}
+filter_chains:
+- filters:
+  - name: envoy.http_connection_manager
+    typed_config:
+      "@type": type.googleapis.com/envoy.extensions.filters.network.http_connection_manager.v3.HttpConnectionManager
+      codec_type: AUTO
+      stat_prefix: server
+      http_filters:
+      - name: envoy.filters.http.wasm
+        typed_config:
+          "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+          type_url: envoy.extensions.filters.http.wasm.v3.Wasm
+          value:
+            config:
+              root_id: "mx_inbound"
+              vm_config:
+                runtime: envoy.wasm.runtime.null
+                code:
+                  local:
+                    inline_string: envoy.wasm.metadata_exchange
+              configuration: "{{ .Vars.MetadataExchangeConfig }}"
+      - name: envoy.filters.http.wasm
+        typed_config:
+          "@type": type.googleapis.com/udpa.type.v1.TypedStruct
+          type_url: envoy.extensions.filters.http.wasm.v3.Wasm
+          value:
+            config:
+              root_id: "stats_inbound"
+              vm_config:
+                vm_id: stats_inbound
+                runtime: envoy.wasm.runtime.null
+                code:
+                  local:
+                    inline_string: envoy.wasm.stats
+              configuration: |
+                {{ .Vars.StatsFilterServerConfig }}
+      - name: envoy.router
+      route_config:
+        name: server
+        virtual_hosts:
+        - name: server
+          domains: ["*"]
+          routes:
+          - match: { prefix: / }
+            route:
+              cluster: inbound|9080|http|server.default.svc.cluster.local
+              timeout: 0s
+`
+
 func EncodeMetadata(t *testing.T, p *driver.Params) string {
+	return EncodeNodeMetadata(t, p, p.Vars["ClientMetadata"])
+}
+
+func EncodeNodeMetadata(t *testing.T, p *driver.Params, metadata string) string {
 	pb := &pstruct.Struct{}
-	err := p.FillYAML("{"+p.Vars["ClientMetadata"]+"}", pb)
+	err := p.FillYAML("{"+metadata+"}", pb)
 	if err != nil {
 		t.Fatal(err)
 	}
@@ -134,3 +195,57 @@ func TestHTTPExchange(t *testing.T) {
 		t.Fatal(err)
 	}
 }
+
+func TestHTTPExchangePeerChange(t *testing.T) {
+	ports := env.NewPorts(env.HTTPExchangePeerChange)
+	params := &driver.Params{
+		Vars: map[string]string{
+			"BackendPort":             fmt.Sprintf("%d", ports.BackendPort),
+			"ServerAdmin":             fmt.Sprintf("%d", ports.ServerAdminPort),
+			"ServerPort":              fmt.Sprintf("%d", ports.ClientToServerProxyPort),
+			"MetadataExchangeConfig":  "{ max_peer_cache_size: 20, max_shared_peer_cache_size: 20 }",
+			"StatsConfig":             driver.LoadTestData("testdata/bootstrap/stats.yaml.tmpl"),
+			"StatsFilterServerConfig": driver.LoadTestJSON("testdata/stats/server_config.yaml"),
+		},
+		XDS: int(ports.XDSPort),
+	}
+	params.Vars["ClientMetadata"] = params.LoadTestData("testdata/client_node_metadata.json.tmpl")
+	params.Vars["ServerMetadata"] = params.LoadTestData("testdata/server_node_metadata.json.tmpl")
+	// The client is redeployed with new labels under the same node ID.
+	changedMetadata := strings.ReplaceAll(params.Vars["ClientMetadata"], `"productpage"`, `"reviews"`)
+	if err := (&driver.Scenario{
+		[]driver.Step{
+			&driver.XDS{},
+			&driver.Update{Node: "server", Version: "0", Listeners: []string{ServerHTTPStatsListener}},
+			&driver.Envoy{Bootstrap: params.LoadTestData("testdata/bootstrap/server.yaml.tmpl")},
+			&driver.Sleep{1 * time.Second},
+			&driver.HTTPCall{
+				Port: ports.ClientToServerProxyPort,
+				Body: "hello, world!",
+				// The peer of a connection does not change, so the redeployed
+				// client connects again.
+				RequestHeaders: map[string]string{
+					"connection":               "close",
+					"x-envoy-peer-metadata-id": "client",
+					"x-envoy-peer-metadata":    EncodeMetadata(t, params),
+				},
+			},
+			&driver.HTTPCall{
+				Port: ports.ClientToServerProxyPort,
+				Body: "hello, world!",
+				RequestHeaders: map[string]string{
+					"x-envoy-peer-metadata-id": "client",
+					"x-envoy-peer-metadata":    EncodeNodeMetadata(t, params, changedMetadata),
+				},
+			},
+			&driver.Stats{ports.ServerAdminPort, map[string]driver.StatMatcher{
+				"istio_requests_total": &driver.LabelStat{[]map[string]string{
+					{"source_app": "productpage"},
+					{"source_app": "reviews"},
+				}},
+			}},
+		},
+	}).Run(params); err != nil {
+		t.Fatal(err)
+	}
+}